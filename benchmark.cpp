@@ -0,0 +1,1070 @@
+#include "benchmark.h"
+#include "chunk-codec.h"
+#include "main-loop.h"
+#include "perlin.h"
+#include "random.h"
+#include "simplex.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+
+const int BENCHMARK_DIM_CHUNKS = 32;
+const int BENCHMARK_PERIOD = 16;
+
+const int BENCHMARK_OCTAVE_PERIODS[] = {64, 32, 16, 8};
+const float BENCHMARK_OCTAVE_AMPLITUDES[] = {8, 4, 2, 1};
+const int BENCHMARK_N_OCTAVES = sizeof(BENCHMARK_OCTAVE_PERIODS) / sizeof(BENCHMARK_OCTAVE_PERIODS[0]);
+
+// Big enough that the chunks, unlike the keys, do not fit in cache
+const int BENCHMARK_TABLE_CAPACITY = 1 << 14;
+const int BENCHMARK_N_LOOKUPS = 1 << 20;
+
+const char BENCHMARK_REGION_DIRECTORY[] = "chunk-regions-benchmark";
+
+// Builds of each chunk's pyramid in a row, the first alone missing the cache
+const int BENCHMARK_N_BOUNDS_BUILDS = 64;
+
+// Checking a ray tests every cube of the terrain
+const int BENCHMARK_N_CHECKED_RAYS = 32;
+
+
+// perlin() as it was before the gradient table, only kept to time the table
+//   against. Lattice corners are hashed through random.h's byte table, and
+//   each corner's gradient takes a cos and sin, and the fades a pow.
+
+vec2
+reference_random_unit_vector(int seed)
+{
+  float theta = random_0_1_float(seed) * 2.0*M_PI;
+  vec2 result;
+  result.x = cos(theta);
+  result.y = sin(theta);
+  return result;
+}
+
+
+int
+reference_hash_vector(vec2 vector)
+{
+  int result = vector.x*2521 + vector.y*7043;
+  return result;
+}
+
+
+float
+perlin_reference(vec2 input, float period)
+{
+  float result;
+
+  input = vec2Multiply(input, 1.0/period);
+
+  vec2 integer_coord = {(float)floor(input.x), (float)floor(input.y)};
+  vec2 fractional = vec2Subtract(input, integer_coord);
+
+  vec2 p00 = vec2Add(integer_coord, {0, 0});
+  vec2 p10 = vec2Add(integer_coord, {1, 0});
+  vec2 p01 = vec2Add(integer_coord, {0, 1});
+  vec2 p11 = vec2Add(integer_coord, {1, 1});
+
+  vec2 gradient00 = reference_random_unit_vector(reference_hash_vector(p00));
+  vec2 gradient10 = reference_random_unit_vector(reference_hash_vector(p10));
+  vec2 gradient01 = reference_random_unit_vector(reference_hash_vector(p01));
+  vec2 gradient11 = reference_random_unit_vector(reference_hash_vector(p11));
+
+  float s = vec2DotProduct(gradient00, vec2Subtract(input, p00));
+  float t = vec2DotProduct(gradient10, vec2Subtract(input, p10));
+  float u = vec2DotProduct(gradient01, vec2Subtract(input, p01));
+  float v = vec2DotProduct(gradient11, vec2Subtract(input, p11));
+
+  float Sx = 3.0*pow(fractional.x, 2.0f) - 2.0*pow(fractional.x, 3.0f);
+  float a = s + Sx*(t - s);
+  float b = u + Sx*(v - u);
+
+  float Sy = 3.0*pow(fractional.y, 2.0f) - 2.0*pow(fractional.y, 3.0f);
+  result = a + Sy*(b - a);
+
+  return result;
+}
+
+
+void
+run_noise_benchmark(BenchmarkResults *results)
+{
+  const int n_samples = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS * CHUNK_SIZE * CHUNK_SIZE;
+
+  // Keep the results live so the loops cannot be optimised away
+  float height_map[CHUNK_SIZE*CHUNK_SIZE] = {};
+  float sum = 0;
+
+  uint64_t reference_start_time = get_us();
+
+  vec2 position;
+  for (position.y = 0;
+       position.y < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.y)
+  for (position.x = 0;
+       position.x < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.x)
+  {
+    sum += perlin_reference(position, BENCHMARK_PERIOD);
+  }
+
+  uint64_t start_time = get_us();
+
+  for (position.y = 0;
+       position.y < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.y)
+  for (position.x = 0;
+       position.x < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.x)
+  {
+    sum += perlin(position, BENCHMARK_PERIOD);
+  }
+
+  uint64_t perlin_end_time = get_us();
+
+  vec2 chunk_position;
+  for (chunk_position.y = 0;
+       chunk_position.y < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.y)
+  for (chunk_position.x = 0;
+       chunk_position.x < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.x)
+  {
+    perlin_tile(vec2Multiply(chunk_position, CHUNK_SIZE), CHUNK_SIZE, CHUNK_SIZE, BENCHMARK_PERIOD, 1, height_map);
+  }
+
+  uint64_t perlin_tile_end_time = get_us();
+
+  for (chunk_position.y = 0;
+       chunk_position.y < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.y)
+  for (chunk_position.x = 0;
+       chunk_position.x < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.x)
+  {
+    perlin_tile_rows(vec2Multiply(chunk_position, CHUNK_SIZE), CHUNK_SIZE, CHUNK_SIZE, BENCHMARK_PERIOD, 1, height_map);
+  }
+
+  uint64_t perlin_tile_rows_end_time = get_us();
+
+  for (chunk_position.y = 0;
+       chunk_position.y < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.y)
+  for (chunk_position.x = 0;
+       chunk_position.x < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.x)
+  {
+    perlin_octaves_tile_generic(vec2Multiply(chunk_position, CHUNK_SIZE), CHUNK_SIZE, BENCHMARK_N_OCTAVES, BENCHMARK_OCTAVE_PERIODS, BENCHMARK_OCTAVE_AMPLITUDES, height_map);
+    sum += height_map[0];
+  }
+
+  uint64_t octaves_generic_end_time = get_us();
+
+  for (chunk_position.y = 0;
+       chunk_position.y < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.y)
+  for (chunk_position.x = 0;
+       chunk_position.x < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.x)
+  {
+    perlin_octaves_tile(vec2Multiply(chunk_position, CHUNK_SIZE), CHUNK_SIZE, BENCHMARK_N_OCTAVES, BENCHMARK_OCTAVE_PERIODS, BENCHMARK_OCTAVE_AMPLITUDES, height_map);
+    sum += height_map[0];
+  }
+
+  uint64_t octaves_specialised_end_time = get_us();
+
+  for (position.y = 0;
+       position.y < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.y)
+  for (position.x = 0;
+       position.x < BENCHMARK_DIM_CHUNKS * CHUNK_SIZE;
+       ++position.x)
+  {
+    sum += simplex(position, BENCHMARK_PERIOD);
+  }
+
+  uint64_t simplex_end_time = get_us();
+
+  for (chunk_position.y = 0;
+       chunk_position.y < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.y)
+  for (chunk_position.x = 0;
+       chunk_position.x < BENCHMARK_DIM_CHUNKS;
+       ++chunk_position.x)
+  {
+    simplex_tile(vec2Multiply(chunk_position, CHUNK_SIZE), CHUNK_SIZE, CHUNK_SIZE, BENCHMARK_PERIOD, 1, height_map);
+  }
+
+  uint64_t simplex_tile_end_time = get_us();
+
+  sum += height_map[0];
+  volatile float sink = sum;
+  (void)sink;
+
+  results->perlin_reference_ns_per_sample = (start_time - reference_start_time) * 1000.0f / n_samples;
+  results->perlin_ns_per_sample = (perlin_end_time - start_time) * 1000.0f / n_samples;
+  results->perlin_tile_ns_per_sample = (perlin_tile_end_time - perlin_end_time) * 1000.0f / n_samples;
+  results->perlin_tile_rows_ns_per_sample = (perlin_tile_rows_end_time - perlin_tile_end_time) * 1000.0f / n_samples;
+  results->octaves_generic_ns_per_sample = (octaves_generic_end_time - perlin_tile_rows_end_time) * 1000.0f / n_samples;
+  results->octaves_specialised_ns_per_sample = (octaves_specialised_end_time - octaves_generic_end_time) * 1000.0f / n_samples;
+  results->simplex_ns_per_sample = (simplex_end_time - octaves_specialised_end_time) * 1000.0f / n_samples;
+  results->simplex_tile_ns_per_sample = (simplex_tile_end_time - simplex_end_time) * 1000.0f / n_samples;
+}
+
+
+/// Time n_lookups lookups of positions, visited in a scattered order so the
+///   hardware prefetcher cannot follow along.
+float
+time_chunk_lookups(ChunkTable *table, std::vector<vec2> &positions, int n_lookups, int *n_found)
+{
+  // Any odd stride visits every position of a power-of-two count
+  const int stride = 7919;
+  int mask = positions.size() - 1;
+
+  int position_n = 0;
+
+  uint64_t start_time = get_us();
+
+  for (int lookup_n = 0;
+       lookup_n < n_lookups;
+       ++lookup_n)
+  {
+    if (chunk_table_find(table, positions[position_n]))
+    {
+      ++*n_found;
+    }
+    position_n = (position_n + stride) & mask;
+  }
+
+  return (get_us() - start_time) * 1000.0f / n_lookups;
+}
+
+
+void
+run_chunk_lookup_benchmark(BenchmarkResults *results)
+{
+  for (int load_n = 0;
+       load_n < N_CHUNK_LOOKUP_BENCHMARK_LOADS;
+       ++load_n)
+  {
+    float load = CHUNK_LOOKUP_BENCHMARK_LOADS[load_n];
+
+    ChunkTable table;
+    chunk_table_init(&table, BENCHMARK_TABLE_CAPACITY);
+    table.max_load = 1;
+
+    // Fill a square of chunks, like the terrain does, and look up positions
+    //   from a disjoint square for misses.
+    int n_chunks = BENCHMARK_TABLE_CAPACITY * load;
+    int width = sqrtf(BENCHMARK_TABLE_CAPACITY);
+
+    std::vector<vec2> hits(BENCHMARK_TABLE_CAPACITY);
+    std::vector<vec2> misses(BENCHMARK_TABLE_CAPACITY);
+    for (int chunk_n = 0;
+         chunk_n < BENCHMARK_TABLE_CAPACITY;
+         ++chunk_n)
+    {
+      vec2 position = {(float)(chunk_n % width), (float)(chunk_n / width)};
+      if (chunk_n < n_chunks)
+      {
+        chunk_table_get(&table, position);
+      }
+      misses[chunk_n] = {-1 - position.x, position.y};
+    }
+
+    // Repeat the resident chunks to fill a power-of-two array
+    for (int chunk_n = 0;
+         chunk_n < BENCHMARK_TABLE_CAPACITY;
+         ++chunk_n)
+    {
+      int resident_n = chunk_n % n_chunks;
+      hits[chunk_n] = {(float)(resident_n % width), (float)(resident_n / width)};
+    }
+
+    int n_found = 0;
+
+    table.n_lookups = 0;
+    table.n_probes = 0;
+    results->chunk_hit_ns[load_n] = time_chunk_lookups(&table, hits, BENCHMARK_N_LOOKUPS, &n_found);
+    results->chunk_probes_per_hit[load_n] = (float)table.n_probes / table.n_lookups;
+
+    results->chunk_miss_ns[load_n] = time_chunk_lookups(&table, misses, BENCHMARK_N_LOOKUPS, &n_found);
+
+    assert(n_found == BENCHMARK_N_LOOKUPS);
+
+    chunk_table_free(&table);
+  }
+}
+
+
+/// Chunk chunk_n of the BENCHMARK_DIM_CHUNKS square the chunk benchmarks work
+///   over, centred on the origin so negative lattice coordinates are hashed
+///   too.
+vec2
+get_benchmark_chunk_position(int chunk_n)
+{
+  return {(float)(chunk_n % BENCHMARK_DIM_CHUNKS - BENCHMARK_DIM_CHUNKS/2),
+          (float)(chunk_n / BENCHMARK_DIM_CHUNKS - BENCHMARK_DIM_CHUNKS/2)};
+}
+
+
+/// Generate every chunk of the benchmark square at full resolution into
+///   generated, returning the microseconds taken per chunk.
+float
+generate_benchmark_chunks(const OctavePlan *plan, std::vector<ChunkMaps> *generated)
+{
+  const int n_chunks = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS;
+  generated->resize(n_chunks);
+
+  uint64_t start_time = get_us();
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    ChunkMaps &maps = (*generated)[chunk_n];
+    generate_chunk(plan, get_benchmark_chunk_position(chunk_n), 0, maps.height_map, maps.slope_map);
+  }
+
+  return (float)(get_us() - start_time) / n_chunks;
+}
+
+
+void
+run_gpu_terrain_check(BenchmarkResults *results, GpuTerrain *gpu_terrain, const OctavePlan *plan)
+{
+  assert(gpu_terrain->n_in_flight == 0);
+
+  const int tile_cells = CHUNK_SIZE*CHUNK_SIZE;
+  const int n_chunks = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS;
+
+  float height_map[tile_cells];
+  vec2 slope_map[tile_cells];
+
+  float max_height_error = 0;
+  float max_slope_error = 0;
+  uint64_t gpu_us = 0;
+  uint64_t cpu_us = 0;
+
+  for (int first_chunk_n = 0;
+       first_chunk_n < n_chunks;
+       first_chunk_n += GPU_TERRAIN_BATCH_TILES)
+  {
+    int n_tiles = std::min(GPU_TERRAIN_BATCH_TILES, n_chunks - first_chunk_n);
+
+    vec2 tile_origins[GPU_TERRAIN_BATCH_TILES];
+    void *tile_tags[GPU_TERRAIN_BATCH_TILES] = {};
+    for (int tile_n = 0;
+         tile_n < n_tiles;
+         ++tile_n)
+    {
+      int chunk_n = first_chunk_n + tile_n;
+      vec2 chunk_position = get_benchmark_chunk_position(chunk_n);
+      tile_origins[tile_n] = vec2Multiply(chunk_position, CHUNK_SIZE);
+    }
+
+    uint64_t gpu_start_time = get_us();
+    gpu_terrain_submit(gpu_terrain, n_tiles, tile_origins, tile_tags, plan->n_octaves, plan->periods, plan->amplitudes);
+    GpuTerrainBatch *batch = gpu_terrain_map_finished(gpu_terrain, true);
+    gpu_us += get_us() - gpu_start_time;
+
+    // A readback that could not be mapped is wrong everywhere
+    if (!batch->heights)
+    {
+      max_height_error = INFINITY;
+      max_slope_error = INFINITY;
+      gpu_terrain_release(gpu_terrain, batch);
+      continue;
+    }
+
+    for (int tile_n = 0;
+         tile_n < n_tiles;
+         ++tile_n)
+    {
+      uint64_t cpu_start_time = get_us();
+      perlin_octaves_tile(tile_origins[tile_n], CHUNK_SIZE, plan->n_octaves, plan->periods, plan->amplitudes, height_map, slope_map);
+      cpu_us += get_us() - cpu_start_time;
+
+      const float *gpu_heights = batch->heights + tile_n*tile_cells;
+      const vec2 *gpu_slopes = batch->slopes + tile_n*tile_cells;
+      for (int cell_n = 0;
+           cell_n < tile_cells;
+           ++cell_n)
+      {
+        max_height_error = std::max(max_height_error, fabsf(gpu_heights[cell_n] - height_map[cell_n]));
+        max_slope_error = std::max(max_slope_error, vec2Length(vec2Subtract(gpu_slopes[cell_n], slope_map[cell_n])));
+      }
+    }
+
+    gpu_terrain_release(gpu_terrain, batch);
+  }
+
+  results->gpu_height_max_error = max_height_error;
+  results->gpu_slope_max_error = max_slope_error;
+  results->gpu_chunk_us = (float)gpu_us / n_chunks;
+  results->cpu_chunk_us = (float)cpu_us / n_chunks;
+}
+
+
+void
+run_chunk_region_benchmark(BenchmarkResults *results, const OctavePlan *plan)
+{
+  const int n_chunks = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS;
+
+  std::vector<vec2> chunk_positions(n_chunks);
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    chunk_positions[chunk_n] = get_benchmark_chunk_position(chunk_n);
+  }
+
+  std::vector<ChunkMaps> generated;
+  results->region_generate_chunk_us = generate_benchmark_chunks(plan, &generated);
+
+  uint64_t start_time = get_us();
+
+  ChunkRegionStore store;
+  if (!chunk_region_store_init(&store, BENCHMARK_REGION_DIRECTORY))
+  {
+    return;
+  }
+  chunk_region_store_clear(&store);
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    chunk_region_store_put(&store, plan->hash, chunk_positions[chunk_n], 0, generated[chunk_n].height_map, generated[chunk_n].slope_map);
+  }
+  chunk_region_store_free(&store);
+
+  uint64_t store_end_time = get_us();
+
+  // Read as the streaming workers read them, each through its own file
+  float height_map[CHUNK_LOD_CELLS];
+  vec2 slope_map[CHUNK_LOD_CELLS];
+  float max_error = 0;
+  uint64_t load_us = 0;
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    uint64_t load_start_time = get_us();
+
+    int read_lod = chunk_region_read(BENCHMARK_REGION_DIRECTORY, plan->hash, chunk_positions[chunk_n], 0, height_map, slope_map);
+
+    load_us += get_us() - load_start_time;
+
+    if (read_lod < 0)
+    {
+      max_error = INFINITY;
+      continue;
+    }
+
+    for (int cell_n = 0;
+         cell_n < CHUNK_LOD_CELLS;
+         ++cell_n)
+    {
+      max_error = std::max(max_error, fabsf(height_map[cell_n] - generated[chunk_n].height_map[cell_n]));
+    }
+  }
+
+  chunk_region_store_clear(&store);
+  rmdir(BENCHMARK_REGION_DIRECTORY);
+
+  results->region_store_chunk_us = (float)(store_end_time - start_time) / n_chunks;
+  results->region_load_chunk_us = (float)load_us / n_chunks;
+  results->region_load_max_error = max_error;
+}
+
+
+void
+run_chunk_codec_benchmark(BenchmarkResults *results, const OctavePlan *plan)
+{
+  const int n_chunks = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS;
+
+  std::vector<ChunkMaps> generated;
+  std::vector<ChunkMaps> decoded(n_chunks);
+  std::vector<uint8_t> data(n_chunks * CHUNK_CODEC_MAX_BYTES);
+  std::vector<int> data_sizes(n_chunks);
+
+  results->codec_generate_chunk_us = generate_benchmark_chunks(plan, &generated);
+
+  uint64_t start_time = get_us();
+
+  float encode_height_error = 0;
+  float encode_slope_error = 0;
+  uint64_t n_bytes = 0;
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    data_sizes[chunk_n] = encode_chunk_maps(0, generated[chunk_n].height_map, generated[chunk_n].slope_map,
+                                            data.data() + chunk_n * CHUNK_CODEC_MAX_BYTES,
+                                            &encode_height_error, &encode_slope_error);
+    n_bytes += data_sizes[chunk_n];
+  }
+
+  uint64_t encode_end_time = get_us();
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    decode_chunk_maps(data.data() + chunk_n * CHUNK_CODEC_MAX_BYTES, data_sizes[chunk_n],
+                      decoded[chunk_n].height_map, decoded[chunk_n].slope_map);
+  }
+
+  uint64_t decode_end_time = get_us();
+
+  // Over every level of detail, the coarser ones being rebuilt from the decoded
+  float max_height_error = 0;
+  float max_slope_error = 0;
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    for (int cell_n = 0;
+         cell_n < CHUNK_LOD_CELLS;
+         ++cell_n)
+    {
+      vec2 slope_error = vec2Subtract(decoded[chunk_n].slope_map[cell_n], generated[chunk_n].slope_map[cell_n]);
+      max_height_error = std::max(max_height_error, fabsf(decoded[chunk_n].height_map[cell_n] - generated[chunk_n].height_map[cell_n]));
+      max_slope_error = std::max(max_slope_error, std::max(fabsf(slope_error.x), fabsf(slope_error.y)));
+    }
+  }
+
+  results->codec_encode_chunk_us = (float)(encode_end_time - start_time) / n_chunks;
+  results->codec_decode_chunk_us = (float)(decode_end_time - encode_end_time) / n_chunks;
+  results->codec_bytes_per_chunk = (float)n_bytes / n_chunks;
+  results->codec_ratio = (float)sizeof(ChunkMaps) * n_chunks / n_bytes;
+  results->codec_max_height_error = max_height_error;
+  results->codec_max_slope_error = max_slope_error;
+}
+
+
+void
+run_chunk_bounds_benchmark(BenchmarkResults *results, const OctavePlan *plan)
+{
+  const int n_chunks = BENCHMARK_DIM_CHUNKS * BENCHMARK_DIM_CHUNKS;
+
+  std::vector<ChunkMaps> generated;
+  results->bounds_generate_chunk_us = generate_benchmark_chunks(plan, &generated);
+
+  std::vector<TerrainChunk> terrain_chunks(n_chunks);
+
+  uint64_t start_time = get_us();
+
+  float max_height_error = 0;
+  float max_slope_error = 0;
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    store_chunk_maps(&terrain_chunks[chunk_n], 0, generated[chunk_n].height_map, generated[chunk_n].slope_map,
+                     &max_height_error, &max_slope_error);
+  }
+
+  uint64_t store_end_time = get_us();
+
+  // Storing builds the pyramid with the heights just written, so each chunk is
+  //   built over and over, rather than the table being swept cold
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    for (int build_n = 0;
+         build_n < BENCHMARK_N_BOUNDS_BUILDS;
+         ++build_n)
+    {
+      build_chunk_bounds(&terrain_chunks[chunk_n], 0);
+    }
+  }
+
+  uint64_t build_end_time = get_us();
+
+  results->bounds_store_chunk_us = (float)(store_end_time - start_time) / n_chunks;
+  results->bounds_build_chunk_us = (float)(build_end_time - store_end_time) / (n_chunks * BENCHMARK_N_BOUNDS_BUILDS);
+}
+
+
+/// Query the height at each of positions a position at a time, then batched
+///   nearest and bilinear with normals, timing each in microseconds, and
+///   returning the largest difference between single and batched nearest.
+float
+time_height_queries(GameState *game_state, const std::vector<vec2> &positions,
+                    float *single_us, float *batch_us, float *bilinear_us)
+{
+  int n_positions = positions.size();
+  std::vector<float> single_heights(n_positions);
+  std::vector<float> batch_heights(n_positions);
+  std::vector<vec3> normals(n_positions);
+
+  uint64_t start_time = get_us();
+
+  for (int position_n = 0;
+       position_n < n_positions;
+       ++position_n)
+  {
+    single_heights[position_n] = get_terrain_height_for_global_position(game_state, positions[position_n]);
+  }
+
+  uint64_t single_end_time = get_us();
+
+  get_terrain_heights(game_state, n_positions, positions.data(), false, batch_heights.data(), 0);
+
+  uint64_t batch_end_time = get_us();
+
+  float max_difference = 0;
+  for (int position_n = 0;
+       position_n < n_positions;
+       ++position_n)
+  {
+    max_difference = std::max(max_difference, fabsf(batch_heights[position_n] - single_heights[position_n]));
+  }
+
+  uint64_t bilinear_start_time = get_us();
+
+  get_terrain_heights(game_state, n_positions, positions.data(), true, batch_heights.data(), normals.data());
+
+  uint64_t bilinear_end_time = get_us();
+
+  *single_us = single_end_time - start_time;
+  *batch_us = batch_end_time - single_end_time;
+  *bilinear_us = bilinear_end_time - bilinear_start_time;
+  return max_difference;
+}
+
+
+void
+run_height_query_benchmark(BenchmarkResults *results, GameState *game_state)
+{
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+  vec2 terrain_origin = vec2Multiply(terrain_min, CHUNK_SIZE);
+  vec2 terrain_size = vec2Multiply(vec2Subtract(terrain_max, terrain_min), CHUNK_SIZE);
+
+  // Scattered in no order, as bodies moving over the terrain would be
+  std::vector<vec2> positions(BENCHMARK_N_HEIGHT_QUERIES);
+  uint32_t random = 1;
+  for (int position_n = 0;
+       position_n < BENCHMARK_N_HEIGHT_QUERIES;
+       ++position_n)
+  {
+    random = random * 1664525 + 1013904223;
+    float x = (random >> 8) * (1.0f / (1 << 24));
+    random = random * 1664525 + 1013904223;
+    float y = (random >> 8) * (1.0f / (1 << 24));
+    positions[position_n] = vec2Add(terrain_origin, {x * terrain_size.x, y * terrain_size.y});
+  }
+
+  float max_difference = time_height_queries(game_state, positions, &results->height_query_single_us,
+                                             &results->height_query_batch_us, &results->height_query_bilinear_us);
+
+  // In groups, as agents gathered around a few places would be, but still in
+  //   no order within or between the groups
+  vec2 cluster_centres[BENCHMARK_N_HEIGHT_QUERY_CLUSTERS];
+  vec2 cluster_range = vec2Subtract(terrain_size, {BENCHMARK_HEIGHT_QUERY_CLUSTER_SIZE, BENCHMARK_HEIGHT_QUERY_CLUSTER_SIZE});
+  for (int cluster_n = 0;
+       cluster_n < BENCHMARK_N_HEIGHT_QUERY_CLUSTERS;
+       ++cluster_n)
+  {
+    random = random * 1664525 + 1013904223;
+    float x = (random >> 8) * (1.0f / (1 << 24));
+    random = random * 1664525 + 1013904223;
+    float y = (random >> 8) * (1.0f / (1 << 24));
+    cluster_centres[cluster_n] = vec2Add(terrain_origin, {x * std::max(cluster_range.x, 0.0f), y * std::max(cluster_range.y, 0.0f)});
+  }
+  for (int position_n = 0;
+       position_n < BENCHMARK_N_HEIGHT_QUERIES;
+       ++position_n)
+  {
+    random = random * 1664525 + 1013904223;
+    int cluster_n = (random >> 8) % BENCHMARK_N_HEIGHT_QUERY_CLUSTERS;
+    random = random * 1664525 + 1013904223;
+    float x = (random >> 8) * (1.0f / (1 << 24));
+    random = random * 1664525 + 1013904223;
+    float y = (random >> 8) * (1.0f / (1 << 24));
+    positions[position_n] = vec2Add(cluster_centres[cluster_n], vec2Multiply({x, y}, BENCHMARK_HEIGHT_QUERY_CLUSTER_SIZE));
+  }
+
+  float clustered_max_difference = time_height_queries(game_state, positions, &results->height_query_clustered_single_us,
+                                                       &results->height_query_clustered_batch_us,
+                                                       &results->height_query_clustered_bilinear_us);
+
+  results->height_query_max_difference = std::max(max_difference, clustered_max_difference);
+}
+
+
+/// The distance along a ray to the first cube of the terrain it meets, testing
+///   every cube, or -1 if it meets none within max_distance.
+float
+cast_terrain_ray_through_every_cube(GameState *game_state, vec3 origin, vec3 direction, float max_distance)
+{
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+
+  float nearest = -1;
+  vec2 chunk_position;
+  for (chunk_position.y = terrain_min.y;
+       chunk_position.y < terrain_max.y;
+       ++chunk_position.y)
+  for (chunk_position.x = terrain_min.x;
+       chunk_position.x < terrain_max.x;
+       ++chunk_position.x)
+  {
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (!terrain_chunk || !terrain_chunk->ready)
+    {
+      continue;
+    }
+
+    int lod = std::max(terrain_chunk->render_lod, terrain_chunk->lod);
+    int size = chunk_lod_size(lod);
+    float cube_size = 1 << lod;
+    vec2 chunk_origin = vec2Multiply(chunk_position, CHUNK_SIZE);
+
+    for (int y = 0;
+         y < size;
+         ++y)
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      vec2 translation = {x*cube_size + 0.5f*(cube_size - 1), y*cube_size + 0.5f*(cube_size - 1)};
+      vec2 centre = vec2Add(chunk_origin, translation);
+      float top = get_chunk_height(*terrain_chunk, chunk_lod_offset(lod) + y*size + x) + 0.5f + get_cube_bounce(game_state, translation);
+
+      vec3 box_min = {centre.x - 0.5f*cube_size, top - cube_size, centre.y - 0.5f*cube_size};
+      vec3 box_max = {centre.x + 0.5f*cube_size, top, centre.y + 0.5f*cube_size};
+      float t_enter = 0;
+      float t_exit = max_distance;
+      for (int axis_n = 0;
+           axis_n < 3;
+           ++axis_n)
+      {
+        if (direction.v[axis_n] == 0)
+        {
+          if (origin.v[axis_n] < box_min.v[axis_n] || origin.v[axis_n] > box_max.v[axis_n])
+          {
+            t_enter = t_exit + 1;
+          }
+          continue;
+        }
+        float t_min = (box_min.v[axis_n] - origin.v[axis_n]) / direction.v[axis_n];
+        float t_max = (box_max.v[axis_n] - origin.v[axis_n]) / direction.v[axis_n];
+        t_enter = std::max(t_enter, std::min(t_min, t_max));
+        t_exit = std::min(t_exit, std::max(t_min, t_max));
+      }
+
+      if (t_enter <= t_exit && (nearest < 0 || t_enter < nearest))
+      {
+        nearest = t_enter;
+      }
+    }
+  }
+
+  return nearest;
+}
+
+
+void
+run_ray_cast_benchmark(BenchmarkResults *results, GameState *game_state)
+{
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+  vec2 terrain_size = vec2Multiply(vec2Subtract(terrain_max, terrain_min), CHUNK_SIZE);
+
+  float max_height = 0;
+  vec2 chunk_position;
+  for (chunk_position.y = terrain_min.y;
+       chunk_position.y < terrain_max.y;
+       ++chunk_position.y)
+  for (chunk_position.x = terrain_min.x;
+       chunk_position.x < terrain_max.x;
+       ++chunk_position.x)
+  {
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (terrain_chunk && terrain_chunk->ready)
+    {
+      max_height = std::max(max_height, terrain_chunk->max_height);
+    }
+  }
+
+  // From above the terrain, descending slowly, so most cross many chunks
+  //   before meeting it, or leave it without
+  std::vector<vec3> origins(BENCHMARK_N_RAYS);
+  std::vector<vec3> directions(BENCHMARK_N_RAYS);
+  uint32_t random = 1;
+  for (int ray_n = 0;
+       ray_n < BENCHMARK_N_RAYS;
+       ++ray_n)
+  {
+    float randoms[4];
+    for (int random_n = 0;
+         random_n < 4;
+         ++random_n)
+    {
+      random = random * 1664525 + 1013904223;
+      randoms[random_n] = (random >> 8) * (1.0f / (1 << 24));
+    }
+
+    vec2 position = vec2Add(vec2Multiply(terrain_min, CHUNK_SIZE), {randoms[0] * terrain_size.x, randoms[1] * terrain_size.y});
+    float angle = randoms[2] * 2*M_PI;
+    origins[ray_n] = {position.x, max_height + 8, position.y};
+    directions[ray_n] = vec3Normalize({cosf(angle), -0.02f - 0.1f*randoms[3], sinf(angle)});
+  }
+
+  float max_distance = 2 * vec2Length(terrain_size);
+  std::vector<TerrainRayHit> hits(BENCHMARK_N_RAYS);
+  std::vector<bool> hit(BENCHMARK_N_RAYS);
+
+  uint64_t start_time = get_us();
+
+  for (int ray_n = 0;
+       ray_n < BENCHMARK_N_RAYS;
+       ++ray_n)
+  {
+    hit[ray_n] = cast_terrain_ray(game_state, origins[ray_n], directions[ray_n], max_distance, &hits[ray_n]);
+  }
+
+  uint64_t end_time = get_us();
+
+  int n_chunks_stepped = 0;
+  int n_cubes_tested = 0;
+  int n_hits = 0;
+  for (int ray_n = 0;
+       ray_n < BENCHMARK_N_RAYS;
+       ++ray_n)
+  {
+    n_chunks_stepped += hits[ray_n].n_chunks_stepped;
+    n_cubes_tested += hits[ray_n].n_cubes_tested;
+    n_hits += hit[ray_n];
+  }
+
+  int n_checked = std::min(BENCHMARK_N_CHECKED_RAYS, BENCHMARK_N_RAYS);
+  int n_mismatches = 0;
+  for (int ray_n = 0;
+       ray_n < n_checked;
+       ++ray_n)
+  {
+    float distance = cast_terrain_ray_through_every_cube(game_state, origins[ray_n], directions[ray_n], max_distance);
+    if ((distance >= 0) != hit[ray_n] ||
+        (hit[ray_n] && fabsf(distance - hits[ray_n].distance) > 0.01f))
+    {
+      ++n_mismatches;
+    }
+  }
+
+  results->ray_cast_us = (float)(end_time - start_time) / BENCHMARK_N_RAYS;
+  results->ray_cast_chunks_stepped = (float)n_chunks_stepped / BENCHMARK_N_RAYS;
+  results->ray_cast_cubes_tested = (float)n_cubes_tested / BENCHMARK_N_RAYS;
+  results->ray_cast_hit_fraction = (float)n_hits / BENCHMARK_N_RAYS;
+  results->ray_cast_n_checked = n_checked;
+  results->ray_cast_n_mismatches = n_mismatches;
+}
+
+
+void
+run_terrain_edit_benchmark(BenchmarkResults *results, GameState *game_state)
+{
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+
+  // Along the middle row of chunks, from the first chunk's centre
+  const float radius = 4;
+  int n_stroke_chunks = std::min((int)(terrain_max.x - terrain_min.x), BENCHMARK_STROKE_CHUNKS);
+  vec2 stroke_start = vec2Add(vec2Multiply({terrain_min.x, floorf(0.5f*(terrain_min.y + terrain_max.y))}, CHUNK_SIZE),
+                              {0.5f*CHUNK_SIZE, 0.5f*CHUNK_SIZE});
+  float stroke_length = (n_stroke_chunks - 1) * CHUNK_SIZE;
+
+  // Snapshot the deltas the stroke reaches, to restore them after
+  int min_x = (int)floorf(stroke_start.x - radius);
+  int min_y = (int)floorf(stroke_start.y - radius);
+  int max_x = (int)ceilf(stroke_start.x + stroke_length + radius);
+  int max_y = (int)ceilf(stroke_start.y + radius);
+  int width = max_x - min_x + 1;
+  std::vector<float> deltas(width * (max_y - min_y + 1));
+  for (int y = min_y;
+       y <= max_y;
+       ++y)
+  for (int x = min_x;
+       x <= max_x;
+       ++x)
+  {
+    deltas[(y - min_y)*width + x - min_x] = get_terrain_delta(game_state, x, y);
+  }
+
+  BrushMode brush_mode = game_state->brush_mode;
+  float brush_radius = game_state->brush_radius;
+  float brush_strength = game_state->brush_strength;
+  game_state->brush_mode = BrushMode::Raise;
+  game_state->brush_radius = radius;
+  game_state->brush_strength = 0.5;
+
+  uint64_t start_time = get_us();
+
+  for (int step_n = 0;
+       step_n < BENCHMARK_N_BRUSH_STEPS;
+       ++step_n)
+  {
+    vec2 centre = vec2Add(stroke_start, {stroke_length * step_n / (BENCHMARK_N_BRUSH_STEPS - 1), 0});
+    apply_terrain_brush(game_state, centre, 0);
+  }
+
+  uint64_t end_time = get_us();
+
+  game_state->brush_mode = brush_mode;
+  game_state->brush_radius = brush_radius;
+  game_state->brush_strength = brush_strength;
+
+  // Every chunk whose slopes the stroke reaches
+  int n_chunks = 0;
+  float max_difference = 0;
+  ChunkMaps generated, edit_maps;
+  vec2 chunk_position;
+  for (chunk_position.y = floorf((float)(min_y - 1) / CHUNK_SIZE);
+       chunk_position.y <= floorf((float)(max_y + 1) / CHUNK_SIZE);
+       ++chunk_position.y)
+  for (chunk_position.x = floorf((float)(min_x - 1) / CHUNK_SIZE);
+       chunk_position.x <= floorf((float)(max_x + 1) / CHUNK_SIZE);
+       ++chunk_position.x)
+  {
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (!terrain_chunk || !terrain_chunk->ready ||
+        !get_chunk_edit_maps(&game_state->terrain_edits, chunk_position, edit_maps.height_map, edit_maps.slope_map))
+    {
+      continue;
+    }
+
+    ++n_chunks;
+    int lod = terrain_chunk->lod;
+    generate_chunk(&game_state->octave_plan, chunk_position, lod, generated.height_map, generated.slope_map);
+    for (int cell_n = chunk_lod_offset(lod);
+         cell_n < CHUNK_LOD_CELLS;
+         ++cell_n)
+    {
+      float height = generated.height_map[cell_n] + edit_maps.height_map[cell_n];
+      max_difference = std::max(max_difference, fabsf(get_chunk_height(*terrain_chunk, cell_n) - height));
+    }
+  }
+
+  set_terrain_deltas(game_state, min_x, min_y, max_x, max_y, deltas.data());
+
+  results->edit_stroke_ms = (end_time - start_time) / 1000.0f;
+  results->edit_brush_us = (float)(end_time - start_time) / BENCHMARK_N_BRUSH_STEPS;
+  results->edit_stroke_n_chunks = n_chunks;
+  results->edit_max_difference = max_difference;
+}
+
+
+#ifdef CHUNK_HALO
+void
+run_chunk_halo_benchmark(BenchmarkResults *results, GameState *game_state)
+{
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+
+  // Chunks at the terrain's edge, or next to one not ready, have halo cells
+  //   copied from their own edges, which the lookups do not see
+  std::vector<TerrainChunk *> chunks;
+  std::vector<vec2> chunk_positions;
+  vec2 chunk_position;
+  for (chunk_position.y = terrain_min.y;
+       chunk_position.y < terrain_max.y;
+       ++chunk_position.y)
+  for (chunk_position.x = terrain_min.x;
+       chunk_position.x < terrain_max.x;
+       ++chunk_position.x)
+  {
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    bool neighbours_ready = true;
+    const vec2 NEIGHBOUR_OFFSETS[] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for (vec2 offset : NEIGHBOUR_OFFSETS)
+    {
+      TerrainChunk *neighbour = find_chunk(game_state, vec2Add(chunk_position, offset));
+      neighbours_ready &= neighbour && neighbour->ready;
+    }
+
+    if (terrain_chunk && terrain_chunk->ready && neighbours_ready)
+    {
+      chunks.push_back(terrain_chunk);
+      chunk_positions.push_back(chunk_position);
+    }
+  }
+
+  int n_chunks = chunks.size();
+  std::vector<vec2> stencil_gradients(n_chunks * CHUNK_SIZE*CHUNK_SIZE);
+  std::vector<vec2> lookup_gradients(n_chunks * CHUNK_SIZE*CHUNK_SIZE);
+
+  uint64_t start_time = get_us();
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    float heights[CHUNK_HALO_SIZE*CHUNK_HALO_SIZE];
+    get_chunk_padded_heights(*chunks[chunk_n], heights);
+
+    vec2 *gradients = stencil_gradients.data() + chunk_n * CHUNK_SIZE*CHUNK_SIZE;
+    for (int y = 0;
+         y < CHUNK_SIZE;
+         ++y)
+    for (int x = 0;
+         x < CHUNK_SIZE;
+         ++x)
+    {
+      const float *height = heights + (y + 1)*CHUNK_HALO_SIZE + x + 1;
+      gradients[y*CHUNK_SIZE + x] = {0.5f * (height[1] - height[-1]),
+                                     0.5f * (height[CHUNK_HALO_SIZE] - height[-CHUNK_HALO_SIZE])};
+    }
+  }
+
+  uint64_t stencil_end_time = get_us();
+
+  for (int chunk_n = 0;
+       chunk_n < n_chunks;
+       ++chunk_n)
+  {
+    vec2 chunk_origin = vec2Multiply(chunk_positions[chunk_n], CHUNK_SIZE);
+    vec2 *gradients = lookup_gradients.data() + chunk_n * CHUNK_SIZE*CHUNK_SIZE;
+    for (int y = 0;
+         y < CHUNK_SIZE;
+         ++y)
+    for (int x = 0;
+         x < CHUNK_SIZE;
+         ++x)
+    {
+      vec2 position = vec2Add(chunk_origin, {(float)x, (float)y});
+      float left = get_terrain_height_for_global_position(game_state, vec2Add(position, {-1, 0}));
+      float right = get_terrain_height_for_global_position(game_state, vec2Add(position, {1, 0}));
+      float below = get_terrain_height_for_global_position(game_state, vec2Add(position, {0, -1}));
+      float above = get_terrain_height_for_global_position(game_state, vec2Add(position, {0, 1}));
+      gradients[y*CHUNK_SIZE + x] = {0.5f * (right - left), 0.5f * (above - below)};
+    }
+  }
+
+  uint64_t lookup_end_time = get_us();
+
+  float max_difference = 0;
+  for (int cell_n = 0;
+       cell_n < n_chunks * CHUNK_SIZE*CHUNK_SIZE;
+       ++cell_n)
+  {
+    max_difference = std::max(max_difference, vec2Length(vec2Subtract(stencil_gradients[cell_n], lookup_gradients[cell_n])));
+  }
+
+  results->halo_stencil_us = stencil_end_time - start_time;
+  results->halo_lookup_us = lookup_end_time - stencil_end_time;
+  results->halo_n_chunks = n_chunks;
+  results->halo_max_difference = max_difference;
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef BENCHMARK_H_DEF
+#define BENCHMARK_H_DEF
+
+
+struct GameState;
+struct GpuTerrain;
+struct OctavePlan;
+
+const float CHUNK_LOOKUP_BENCHMARK_LOADS[] = {0.25, 0.5, 0.75, 0.9};
+const int N_CHUNK_LOOKUP_BENCHMARK_LOADS = sizeof(CHUNK_LOOKUP_BENCHMARK_LOADS) / sizeof(CHUNK_LOOKUP_BENCHMARK_LOADS[0]);
+
+const int BENCHMARK_N_HEIGHT_QUERIES = 4096;
+
+// The clustered height queries fall in this many squares of cubes this wide
+const int BENCHMARK_N_HEIGHT_QUERY_CLUSTERS = 16;
+const float BENCHMARK_HEIGHT_QUERY_CLUSTER_SIZE = 32;
+
+const int BENCHMARK_N_RAYS = 1024;
+
+// Brush applications in a stroke across up to BENCHMARK_STROKE_CHUNKS chunks
+const int BENCHMARK_N_BRUSH_STEPS = 64;
+const int BENCHMARK_STROKE_CHUNKS = 10;
+
+struct BenchmarkResults
+{
+  // perlin() against the trig and float hash version it replaced
+  float perlin_reference_ns_per_sample;
+  float perlin_ns_per_sample;
+  float perlin_tile_ns_per_sample;
+  float perlin_tile_rows_ns_per_sample;
+
+  // Per sample of the summed octaves
+  float octaves_generic_ns_per_sample;
+  float octaves_specialised_ns_per_sample;
+
+  float simplex_ns_per_sample;
+  float simplex_tile_ns_per_sample;
+
+  // Indexed like CHUNK_LOOKUP_BENCHMARK_LOADS
+  float chunk_hit_ns[N_CHUNK_LOOKUP_BENCHMARK_LOADS];
+  float chunk_miss_ns[N_CHUNK_LOOKUP_BENCHMARK_LOADS];
+  float chunk_probes_per_hit[N_CHUNK_LOOKUP_BENCHMARK_LOADS];
+
+  // Largest differences between the GPU and CPU chunks
+  float gpu_height_max_error;
+  float gpu_slope_max_error;
+  float gpu_chunk_us;
+  float cpu_chunk_us;
+
+  // Generating chunks against storing them into and loading them from region
+  //   files, and the largest difference between the loaded and generated heights
+  float region_generate_chunk_us;
+  float region_store_chunk_us;
+  float region_load_chunk_us;
+  float region_load_max_error;
+
+  // Generating chunks against compressing and decompressing them for the chunk
+  //   cache, the compressed size, and the largest rounding of the decompressed
+  float codec_generate_chunk_us;
+  float codec_encode_chunk_us;
+  float codec_decode_chunk_us;
+  float codec_bytes_per_chunk;
+  float codec_ratio;
+  float codec_max_height_error;
+  float codec_max_slope_error;
+
+  // Generating chunks against storing them and building their min/max height
+  //   pyramids, which storing includes
+  float bounds_generate_chunk_us;
+  float bounds_store_chunk_us;
+  float bounds_build_chunk_us;
+
+  // Heights of BENCHMARK_N_HEIGHT_QUERIES positions scattered over the terrain,
+  //   and of as many clustered in a few places, a position at a time against
+  //   batched, and the largest difference between the two over both
+  float height_query_single_us;
+  float height_query_batch_us;
+  float height_query_bilinear_us;
+  float height_query_clustered_single_us;
+  float height_query_clustered_batch_us;
+  float height_query_clustered_bilinear_us;
+  float height_query_max_difference;
+
+  // BENCHMARK_N_RAYS rays cast low over the terrain, the chunks and cubes each
+  //   visited on average, and how many of the first few disagree with testing
+  //   every cube
+  float ray_cast_us;
+  float ray_cast_chunks_stepped;
+  float ray_cast_cubes_tested;
+  float ray_cast_hit_fraction;
+  int ray_cast_n_checked;
+  int ray_cast_n_mismatches;
+
+  // A stroke of BENCHMARK_N_BRUSH_STEPS brush applications, the chunks it
+  //   crosses, and the largest difference between the heights it leaves and
+  //   the touched chunks generated again with their edits
+  float edit_stroke_ms;
+  float edit_brush_us;
+  int edit_stroke_n_chunks;
+  float edit_max_difference;
+
+  // A central difference stencil over every full resolution cube of the
+  //   chunks whose four neighbours are ready, from each chunk's cubes and halo
+  //   against looking up each cube's neighbours, and the largest difference
+  //   between the two
+  float halo_stencil_us;
+  float halo_lookup_us;
+  int halo_n_chunks;
+  float halo_max_difference;
+};
+
+
+/// Time perlin() against the version before the gradient table, perlin_tile()
+///   and perlin_tile_rows() over a square of chunk-sized tiles, the generic and
+///   specialised perlin_octaves_tile() on a few octaves, and simplex() and
+///   simplex_tile() on the same tiles.
+void
+run_noise_benchmark(BenchmarkResults *results);
+
+/// Time chunk_table_find() hits and misses in a table filled to each of
+///   CHUNK_LOOKUP_BENCHMARK_LOADS.
+void
+run_chunk_lookup_benchmark(BenchmarkResults *results);
+
+/// Generate a square of chunks around the origin with both gpu_terrain and
+///   perlin_octaves_tile(), comparing their heights and slopes and timing
+///   each. Nothing may be in flight on gpu_terrain.
+void
+run_gpu_terrain_check(BenchmarkResults *results, GpuTerrain *gpu_terrain, const OctavePlan *plan);
+
+/// Generate a square of chunks around the origin, store them into region files
+///   in a scratch directory, and read them back with chunk_region_read() as
+///   the streaming workers do. The files will still be in the page cache, so
+///   loading is timed against copying from it rather than the disk.
+void
+run_chunk_region_benchmark(BenchmarkResults *results, const OctavePlan *plan);
+
+/// Generate a square of chunks around the origin, then compress and decompress
+///   them as the chunk cache does, comparing the decompressed maps of every
+///   level of detail against the generated.
+void
+run_chunk_codec_benchmark(BenchmarkResults *results, const OctavePlan *plan);
+
+/// Generate a square of chunks around the origin, store them into chunks, and
+///   build their min/max height pyramids again on their own, while the heights
+///   are in cache as they are when storing.
+void
+run_chunk_bounds_benchmark(BenchmarkResults *results, const OctavePlan *plan);
+
+/// Query the terrain's height at positions scattered over game_state's
+///   terrain, then at positions clustered in a few places on it, with
+///   get_terrain_height_for_global_position() and with get_terrain_heights(),
+///   nearest and bilinear with normals.
+void
+run_height_query_benchmark(BenchmarkResults *results, GameState *game_state);
+
+/// Cast rays low over game_state's terrain with cast_terrain_ray(), checking
+///   the first few against every cube of the terrain.
+void
+run_ray_cast_benchmark(BenchmarkResults *results, GameState *game_state);
+
+/// Raise game_state's terrain with a brush stroke across its middle, check the
+///   edited chunks against generating them again, and undo the stroke.
+void
+run_terrain_edit_benchmark(BenchmarkResults *results, GameState *game_state);
+
+#ifdef CHUNK_HALO
+/// Take the gradient of game_state's terrain at every cube with a stencil over
+///   get_chunk_padded_heights(), and with
+///   get_terrain_height_for_global_position() at each cube's neighbours.
+void
+run_chunk_halo_benchmark(BenchmarkResults *results, GameState *game_state);
+#endif
+
+
+#endif
@@ -0,0 +1,159 @@
+#include "chunk-cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/// First entry of the key's set. The parameter and position hashes are mixed
+///   again, and the set taken from the top bits, so the chunks of different
+///   parameter sets do not pile into the same sets.
+int
+first_way(ChunkCache *cache, uint64_t parameter_hash, vec2 position)
+{
+  uint64_t hash = (parameter_hash ^ chunk_position_hash(position)) * 0x9e3779b97f4a7c15;
+  int n_sets_log2 = __builtin_ctz(cache->capacity / CHUNK_CACHE_WAYS);
+  return n_sets_log2 ? (hash >> (64 - n_sets_log2)) * CHUNK_CACHE_WAYS : 0;
+}
+
+
+bool
+key_matches(const ChunkCacheKey &key, uint64_t parameter_hash, vec2 position)
+{
+  return key.parameter_hash == parameter_hash && vec2Equal(key.position, position);
+}
+
+
+void
+chunk_cache_init(ChunkCache *cache, int capacity)
+{
+  assert((capacity & (capacity - 1)) == 0 && capacity >= CHUNK_CACHE_WAYS);
+
+  cache->keys = (ChunkCacheKey *)calloc_cache_aligned(capacity, sizeof(ChunkCacheKey));
+  cache->entries = (ChunkCacheEntry *)calloc_cache_aligned(capacity, sizeof(ChunkCacheEntry));
+  cache->capacity = capacity;
+  cache->n_entries = 0;
+  cache->clock = 0;
+  cache->n_data_bytes = 0;
+
+  cache->n_hits = 0;
+  cache->n_misses = 0;
+  cache->n_evictions = 0;
+}
+
+
+void
+chunk_cache_free(ChunkCache *cache)
+{
+  for (int entry_n = 0;
+       entry_n < cache->capacity;
+       ++entry_n)
+  {
+    free(cache->entries[entry_n].data);
+  }
+
+  free(cache->keys);
+  free(cache->entries);
+  cache->keys = 0;
+  cache->entries = 0;
+}
+
+
+void
+chunk_cache_clear(ChunkCache *cache)
+{
+  memset(cache->keys, 0, cache->capacity * sizeof(ChunkCacheKey));
+  cache->n_entries = 0;
+
+  // The buffers are kept for reuse
+  for (int entry_n = 0;
+       entry_n < cache->capacity;
+       ++entry_n)
+  {
+    cache->entries[entry_n].size = 0;
+  }
+  cache->n_data_bytes = 0;
+}
+
+
+const ChunkCacheEntry *
+chunk_cache_find(ChunkCache *cache, uint64_t parameter_hash, vec2 position, int lod, int *found_lod)
+{
+  int set_n = first_way(cache, parameter_hash, position);
+  for (int way_n = set_n;
+       way_n < set_n + CHUNK_CACHE_WAYS;
+       ++way_n)
+  {
+    ChunkCacheKey &key = cache->keys[way_n];
+    if (key_matches(key, parameter_hash, position) && key.lod <= lod)
+    {
+      key.last_used = ++cache->clock;
+      *found_lod = key.lod;
+      ++cache->n_hits;
+      return cache->entries + way_n;
+    }
+  }
+
+  ++cache->n_misses;
+  return 0;
+}
+
+
+void
+chunk_cache_put(ChunkCache *cache, uint64_t parameter_hash, vec2 position, int lod, const uint8_t *data, int size)
+{
+  assert(parameter_hash != 0);
+
+  // Prefer the chunk's own entry, then an empty one, then the least recently used
+  int set_n = first_way(cache, parameter_hash, position);
+  int chosen_way_n = -1;
+  for (int way_n = set_n;
+       way_n < set_n + CHUNK_CACHE_WAYS;
+       ++way_n)
+  {
+    if (key_matches(cache->keys[way_n], parameter_hash, position))
+    {
+      chosen_way_n = way_n;
+      break;
+    }
+    if (chosen_way_n == -1 ||
+        (cache->keys[chosen_way_n].parameter_hash != 0 &&
+         (cache->keys[way_n].parameter_hash == 0 || cache->keys[way_n].last_used < cache->keys[chosen_way_n].last_used)))
+    {
+      chosen_way_n = way_n;
+    }
+  }
+
+  ChunkCacheKey &key = cache->keys[chosen_way_n];
+  if (key_matches(key, parameter_hash, position))
+  {
+    if (key.lod <= lod)
+    {
+      return;
+    }
+  }
+  else if (key.parameter_hash != 0)
+  {
+    ++cache->n_evictions;
+  }
+  else
+  {
+    ++cache->n_entries;
+  }
+
+  key.parameter_hash = parameter_hash;
+  key.position = position;
+  key.lod = lod;
+  key.last_used = ++cache->clock;
+
+  ChunkCacheEntry &entry = cache->entries[chosen_way_n];
+  if (entry.capacity < size)
+  {
+    free(entry.data);
+    entry.data = (uint8_t *)malloc(size);
+    entry.capacity = size;
+  }
+  memcpy(entry.data, data, size);
+  cache->n_data_bytes += size - entry.size;
+  entry.size = size;
+}
@@ -0,0 +1,78 @@
+#ifndef CHUNK_CACHE_H_DEF
+#define CHUNK_CACHE_H_DEF
+
+#include "chunk-table.h"
+
+
+const int CHUNK_CACHE_WAYS = 4;
+
+/// Identifies a cached chunk by its content: the hash of the octave plan it was
+///   generated from and its position. A parameter_hash of 0 marks an empty entry.
+struct ChunkCacheKey
+{
+  uint64_t parameter_hash;
+  vec2 position;
+
+  // Finest level of detail held, levels finer than it are unset
+  int lod;
+
+  // ChunkCache::clock when the entry was last put or found
+  uint32_t last_used;
+};
+
+/// The chunk's maps compressed by encode_chunk_maps(), in a buffer of capacity
+///   bytes kept for the next chunk put into the entry.
+struct ChunkCacheEntry
+{
+  uint8_t *data;
+  int size;
+  int capacity;
+};
+
+/// Set-associative cache of generated chunk maps, which outlives terrain_gen_id
+///   changes so that returning to a parameter set does not generate its chunks
+///   again. Each key hashes to a set of CHUNK_CACHE_WAYS entries, and putting a
+///   new key into a full set evicts the least recently used. Like the chunk
+///   table, entry n's key is keys[n] and its compressed maps are entries[n].
+struct ChunkCache
+{
+  ChunkCacheKey *keys;
+  ChunkCacheEntry *entries;
+  int capacity;
+  int n_entries;
+
+  uint32_t clock;
+
+  // Bytes of compressed maps held by the entries
+  uint64_t n_data_bytes;
+
+  // Stats, left for the caller to reset
+  uint64_t n_hits;
+  uint64_t n_misses;
+  uint64_t n_evictions;
+};
+
+
+/// capacity must be a power of two and a multiple of CHUNK_CACHE_WAYS.
+void
+chunk_cache_init(ChunkCache *cache, int capacity);
+
+void
+chunk_cache_free(ChunkCache *cache);
+
+void
+chunk_cache_clear(ChunkCache *cache);
+
+/// Return the compressed maps of position generated from parameter_hash at
+///   level lod or finer, setting found_lod to the finest level held, or 0 if
+///   there are none. The entry is only valid until the next put.
+const ChunkCacheEntry *
+chunk_cache_find(ChunkCache *cache, uint64_t parameter_hash, vec2 position, int lod, int *found_lod);
+
+/// Copy maps compressed from level lod into the cache, unless it already holds
+///   the chunk at lod or finer.
+void
+chunk_cache_put(ChunkCache *cache, uint64_t parameter_hash, vec2 position, int lod, const uint8_t *data, int size);
+
+
+#endif
@@ -0,0 +1,113 @@
+#include "chunk-clipmap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+
+void
+chunk_clipmap_init(ChunkClipmap *clipmap, int size_log2)
+{
+  clipmap->size_log2 = size_log2;
+  clipmap->size = 1 << size_log2;
+  clipmap->keys = (ChunkKey *)calloc_cache_aligned(clipmap->size * clipmap->size, sizeof(ChunkKey));
+  clipmap->cells = (TerrainChunk *)calloc_cache_aligned(clipmap->size * clipmap->size, sizeof(TerrainChunk));
+  clipmap->origin = {};
+
+  // terrain_gen_id 0 marks cells which have never been claimed
+  clipmap->terrain_gen_id = 1;
+}
+
+
+void
+chunk_clipmap_free(ChunkClipmap *clipmap)
+{
+  for (int cell_n = 0;
+       cell_n < clipmap->size * clipmap->size;
+       ++cell_n)
+  {
+    if (clipmap->cells[cell_n].height_buffer)
+    {
+      glDeleteBuffers(1, &clipmap->cells[cell_n].height_buffer);
+    }
+  }
+
+  free(clipmap->keys);
+  free(clipmap->cells);
+  clipmap->keys = 0;
+  clipmap->cells = 0;
+}
+
+
+void
+chunk_clipmap_clear(ChunkClipmap *clipmap)
+{
+  clipmap->terrain_gen_id++;
+}
+
+
+void
+chunk_clipmap_move(ChunkClipmap *clipmap, vec2 origin)
+{
+  // Nothing to do up front, cells of chunks leaving the window are simply
+  //   claimed by the chunks entering it.
+  clipmap->origin = origin;
+}
+
+
+bool
+in_window(ChunkClipmap *clipmap, vec2 position)
+{
+  return position.x >= clipmap->origin.x && position.x < clipmap->origin.x + clipmap->size &&
+         position.y >= clipmap->origin.y && position.y < clipmap->origin.y + clipmap->size;
+}
+
+
+int
+get_cell(ChunkClipmap *clipmap, vec2 position)
+{
+  int mask = clipmap->size - 1;
+  int x = (int)position.x & mask;
+  int y = (int)position.y & mask;
+  return (y << clipmap->size_log2) | x;
+}
+
+
+TerrainChunk *
+chunk_clipmap_find(ChunkClipmap *clipmap, vec2 position)
+{
+  int cell_n = get_cell(clipmap, position);
+  ChunkKey &key = clipmap->keys[cell_n];
+  if (key.terrain_gen_id == clipmap->terrain_gen_id &&
+      vec2Equal(key.position, position) &&
+      in_window(clipmap, position))
+  {
+    return clipmap->cells + cell_n;
+  }
+  return 0;
+}
+
+
+TerrainChunk &
+chunk_clipmap_get(ChunkClipmap *clipmap, vec2 position, bool *new_chunk)
+{
+  assert(in_window(clipmap, position));
+
+  int cell_n = get_cell(clipmap, position);
+  ChunkKey &key = clipmap->keys[cell_n];
+  TerrainChunk *cell = clipmap->cells + cell_n;
+
+  bool claimed = key.terrain_gen_id != clipmap->terrain_gen_id || !vec2Equal(key.position, position);
+  if (claimed)
+  {
+    key.position = position;
+    key.terrain_gen_id = clipmap->terrain_gen_id;
+    cell->ready = false;
+  }
+
+  if (new_chunk)
+  {
+    *new_chunk = claimed;
+  }
+
+  return *cell;
+}
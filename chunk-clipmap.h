@@ -0,0 +1,51 @@
+#ifndef CHUNK_CLIPMAP_H_DEF
+#define CHUNK_CLIPMAP_H_DEF
+
+#include "chunk-table.h"
+
+
+/// Fixed window of size x size chunks around the camera, stored as a 2D ring
+///   buffer: the chunk at position p always lives in cell (p mod size), so
+///   lookups are a mask and a shift. Moving the window by one chunk reuses
+///   exactly one row or column of cells for the chunks entering it. Like the
+///   chunk table, cell n's key is keys[n] and its chunk is cells[n].
+struct ChunkClipmap
+{
+  ChunkKey *keys;
+  TerrainChunk *cells;
+  int size_log2;
+  int size;
+
+  // The chunk position of the window's minimum corner
+  vec2 origin;
+
+  int terrain_gen_id;
+};
+
+
+void
+chunk_clipmap_init(ChunkClipmap *clipmap, int size_log2);
+
+void
+chunk_clipmap_free(ChunkClipmap *clipmap);
+
+/// Empty the clipmap by starting a new terrain_gen_id.
+void
+chunk_clipmap_clear(ChunkClipmap *clipmap);
+
+/// Move the window, chunks which fall outside it can no longer be found.
+void
+chunk_clipmap_move(ChunkClipmap *clipmap, vec2 origin);
+
+/// Return the chunk at position, or 0 if it is outside the window or has not
+///   been claimed yet.
+TerrainChunk *
+chunk_clipmap_find(ChunkClipmap *clipmap, vec2 position);
+
+/// Claim position's cell if it does not hold the chunk already, position
+///   must be inside the window.
+TerrainChunk &
+chunk_clipmap_get(ChunkClipmap *clipmap, vec2 position, bool *new_chunk = 0);
+
+
+#endif
@@ -0,0 +1,290 @@
+#include "chunk-codec.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+
+const int CHUNK_CODEC_N_CHANNELS = 3;
+
+
+inline uint32_t
+zigzag(uint32_t residual)
+{
+  return (residual << 1) ^ (uint32_t)((int32_t)residual >> 31);
+}
+
+
+inline uint32_t
+unzigzag(uint32_t value)
+{
+  return (value >> 1) ^ (0u - (value & 1));
+}
+
+
+/// Bytes taken by n_values values packed width bits each.
+inline int
+get_packed_bytes(int n_values, int width)
+{
+  return (n_values * width + 7) / 8;
+}
+
+
+/// Append one channel's residuals to data, returning the bytes written. Each
+///   block is a byte holding its width, the bits of its largest residual, then
+///   its residuals packed at that width, little endian. data must have 8 bytes
+///   of slack past the end, for the packing's whole-word stores.
+int
+encode_channel(const uint32_t *values, int size, uint8_t *data)
+{
+  int n_values = size*size;
+
+  // Predicting each value as west + north - north-west leaves the residual
+  //   differenced along the row then down the column
+  uint32_t residuals[CHUNK_SIZE*CHUNK_SIZE];
+  for (int y = 0;
+       y < size;
+       ++y)
+  {
+    residuals[y*size] = values[y*size];
+    for (int x = 1;
+         x < size;
+         ++x)
+    {
+      residuals[y*size + x] = values[y*size + x] - values[y*size + x - 1];
+    }
+  }
+  for (int y = size - 1;
+       y > 0;
+       --y)
+  for (int x = 0;
+       x < size;
+       ++x)
+  {
+    residuals[y*size + x] -= residuals[(y - 1)*size + x];
+  }
+  for (int value_n = 0;
+       value_n < n_values;
+       ++value_n)
+  {
+    residuals[value_n] = zigzag(residuals[value_n]);
+  }
+
+  int n_bytes = 0;
+  for (int block_start = 0;
+       block_start < n_values;
+       block_start += CHUNK_CODEC_BLOCK_SIZE)
+  {
+    int block_size = n_values - block_start < CHUNK_CODEC_BLOCK_SIZE ? n_values - block_start : CHUNK_CODEC_BLOCK_SIZE;
+
+    uint32_t all_bits = 0;
+    for (int value_n = block_start;
+         value_n < block_start + block_size;
+         ++value_n)
+    {
+      all_bits |= residuals[value_n];
+    }
+    int width = all_bits ? 32 - __builtin_clz(all_bits) : 0;
+
+    data[n_bytes++] = (uint8_t)width;
+
+    // Values are gathered in a word and stored 32 bits at a time
+    uint8_t *packed = data + n_bytes;
+    uint64_t bits = 0;
+    int n_bits = 0;
+    for (int value_n = block_start;
+         value_n < block_start + block_size;
+         ++value_n)
+    {
+      bits |= (uint64_t)residuals[value_n] << n_bits;
+      n_bits += width;
+      if (n_bits >= 32)
+      {
+        uint32_t word = (uint32_t)bits;
+        memcpy(packed, &word, 4);
+        packed += 4;
+        bits >>= 32;
+        n_bits -= 32;
+      }
+    }
+    memcpy(packed, &bits, 8);
+
+    n_bytes += get_packed_bytes(block_size, width);
+  }
+
+  return n_bytes;
+}
+
+
+/// Unpack n_values residuals packed width bits each. data must have 8 bytes of
+///   slack past the end, for the whole-word loads.
+inline void
+unpack_block(const uint8_t *packed, int width, int n_values, uint32_t *residuals)
+{
+  uint64_t mask = (1ull << width) - 1;
+  for (int value_n = 0;
+       value_n < n_values;
+       ++value_n)
+  {
+    int bit_n = value_n * width;
+    uint64_t word;
+    memcpy(&word, packed + bit_n/8, 8);
+    residuals[value_n] = (uint32_t)((word >> (bit_n % 8)) & mask);
+  }
+}
+
+
+/// unpack_block() for a whole block of a fixed width, so every load, shift and
+///   mask is a constant.
+template <int WIDTH>
+void
+unpack_block_fixed(const uint8_t *packed, uint32_t *residuals)
+{
+  unpack_block(packed, WIDTH, CHUNK_CODEC_BLOCK_SIZE, residuals);
+}
+
+typedef void (*UnpackBlockKernel)(const uint8_t *packed, uint32_t *residuals);
+
+const UnpackBlockKernel UNPACK_BLOCK_KERNELS[33] = {
+  unpack_block_fixed<0>,  unpack_block_fixed<1>,  unpack_block_fixed<2>,  unpack_block_fixed<3>,
+  unpack_block_fixed<4>,  unpack_block_fixed<5>,  unpack_block_fixed<6>,  unpack_block_fixed<7>,
+  unpack_block_fixed<8>,  unpack_block_fixed<9>,  unpack_block_fixed<10>, unpack_block_fixed<11>,
+  unpack_block_fixed<12>, unpack_block_fixed<13>, unpack_block_fixed<14>, unpack_block_fixed<15>,
+  unpack_block_fixed<16>, unpack_block_fixed<17>, unpack_block_fixed<18>, unpack_block_fixed<19>,
+  unpack_block_fixed<20>, unpack_block_fixed<21>, unpack_block_fixed<22>, unpack_block_fixed<23>,
+  unpack_block_fixed<24>, unpack_block_fixed<25>, unpack_block_fixed<26>, unpack_block_fixed<27>,
+  unpack_block_fixed<28>, unpack_block_fixed<29>, unpack_block_fixed<30>, unpack_block_fixed<31>,
+  unpack_block_fixed<32>
+};
+
+
+/// Read one channel written by encode_channel() into values[n * stride] in
+///   units of step, returning the bytes read. data must have 8 bytes of slack
+///   past the end, for the whole-word loads.
+int
+decode_channel(const uint8_t *data, int size, float step, float *values, int stride)
+{
+  int n_values = size*size;
+
+  // Unlike a variable length code, every residual of a block can be unpacked
+  //   at once, with no chain of reads between them
+  uint32_t residuals[CHUNK_SIZE*CHUNK_SIZE];
+  int n_bytes = 0;
+  for (int block_start = 0;
+       block_start < n_values;
+       block_start += CHUNK_CODEC_BLOCK_SIZE)
+  {
+    int width = data[n_bytes++];
+    int block_size = n_values - block_start;
+    if (block_size >= CHUNK_CODEC_BLOCK_SIZE)
+    {
+      block_size = CHUNK_CODEC_BLOCK_SIZE;
+      UNPACK_BLOCK_KERNELS[width](data + n_bytes, residuals + block_start);
+    }
+    else
+    {
+      unpack_block(data + n_bytes, width, block_size, residuals + block_start);
+    }
+    n_bytes += get_packed_bytes(block_size, width);
+  }
+
+  // Undo the differencing a row at a time, summing down the columns across the
+  //   row, which vectorises, then along the row in a register
+  int32_t column_sums[CHUNK_SIZE] = {};
+  for (int y = 0;
+       y < size;
+       ++y)
+  {
+    const uint32_t *row_residuals = residuals + y*size;
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      column_sums[x] += (int32_t)unzigzag(row_residuals[x]);
+    }
+
+    int32_t sum = 0;
+    float *row_values = values + y*size*stride;
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      sum += column_sums[x];
+      row_values[x*stride] = sum * step;
+    }
+  }
+
+  return n_bytes;
+}
+
+
+int
+encode_chunk_maps(int lod, const float *height_map, const vec2 *slope_map, uint8_t *data,
+                  float *max_height_error, float *max_slope_error)
+{
+  int size = chunk_lod_size(lod);
+  int n_cells = size*size;
+  const float *heights = height_map + chunk_lod_offset(lod);
+  const vec2 *slopes = slope_map + chunk_lod_offset(lod);
+
+  // Rounded to steps, as two's complement so the prediction can wrap
+  uint32_t channels[CHUNK_CODEC_N_CHANNELS][CHUNK_SIZE*CHUNK_SIZE];
+  float height_error = 0;
+  float slope_error = 0;
+  for (int cell_n = 0;
+       cell_n < n_cells;
+       ++cell_n)
+  {
+    int32_t height = lrintf(heights[cell_n] * (1 / CHUNK_CODEC_HEIGHT_STEP));
+    int32_t slope_x = lrintf(slopes[cell_n].x * (1 / CHUNK_CODEC_SLOPE_STEP));
+    int32_t slope_y = lrintf(slopes[cell_n].y * (1 / CHUNK_CODEC_SLOPE_STEP));
+
+    height_error = fmaxf(height_error, fabsf(height * CHUNK_CODEC_HEIGHT_STEP - heights[cell_n]));
+    slope_error = fmaxf(slope_error, fmaxf(fabsf(slope_x * CHUNK_CODEC_SLOPE_STEP - slopes[cell_n].x),
+                                           fabsf(slope_y * CHUNK_CODEC_SLOPE_STEP - slopes[cell_n].y)));
+
+    channels[0][cell_n] = (uint32_t)height;
+    channels[1][cell_n] = (uint32_t)slope_x;
+    channels[2][cell_n] = (uint32_t)slope_y;
+  }
+  *max_height_error = fmaxf(*max_height_error, height_error);
+  *max_slope_error = fmaxf(*max_slope_error, slope_error);
+
+  data[0] = (uint8_t)lod;
+  int n_bytes = 1;
+  for (int channel_n = 0;
+       channel_n < CHUNK_CODEC_N_CHANNELS;
+       ++channel_n)
+  {
+    n_bytes += encode_channel(channels[channel_n], size, data + n_bytes);
+  }
+
+  assert(n_bytes + 8 <= CHUNK_CODEC_MAX_BYTES);
+  return n_bytes;
+}
+
+
+int
+decode_chunk_maps(const uint8_t *data, int size, float *height_map, vec2 *slope_map)
+{
+  // Copied for the slack the whole-word loads need, which costs far less than
+  //   the decoding
+  uint8_t padded[CHUNK_CODEC_MAX_BYTES];
+  assert(size + 8 <= CHUNK_CODEC_MAX_BYTES);
+  memcpy(padded, data, size);
+  memset(padded + size, 0, 8);
+
+  int lod = padded[0];
+  int lod_size = chunk_lod_size(lod);
+  float *heights = height_map + chunk_lod_offset(lod);
+  vec2 *slopes = slope_map + chunk_lod_offset(lod);
+
+  int n_bytes = 1;
+  n_bytes += decode_channel(padded + n_bytes, lod_size, CHUNK_CODEC_HEIGHT_STEP, heights, 1);
+  n_bytes += decode_channel(padded + n_bytes, lod_size, CHUNK_CODEC_SLOPE_STEP, &slopes->x, 2);
+  n_bytes += decode_channel(padded + n_bytes, lod_size, CHUNK_CODEC_SLOPE_STEP, &slopes->y, 2);
+  assert(n_bytes == size);
+
+  build_chunk_lods(lod, height_map, slope_map);
+  return lod;
+}
@@ -0,0 +1,46 @@
+#ifndef CHUNK_CODEC_H_DEF
+#define CHUNK_CODEC_H_DEF
+
+#include "chunk-table.h"
+#include <stdint.h>
+
+
+// Chunk compression
+//
+// Chunks in the chunk cache are kept compressed. Only the finest level of
+//   detail held is coded, the coarser levels being rebuilt from it by
+//   build_chunk_lods() as they were when generated. Heights and slopes are
+//   rounded to multiples of CHUNK_CODEC_HEIGHT_STEP and CHUNK_CODEC_SLOPE_STEP,
+//   and each is predicted from its west, north and north-west neighbours. The
+//   terrain is smooth at the scale of a cube, so the residuals are small, and
+//   each block of CHUNK_CODEC_BLOCK_SIZE is bit packed at the width of its
+//   largest. Packing compresses a little less than an entropy code, but
+//   unpacks without any serial chain of bit reads, so decoding costs about as
+//   much as generating a single octave. Plans cheaper than that are generated
+//   again rather than decoded, see decode_is_cheaper().
+
+const float CHUNK_CODEC_HEIGHT_STEP = 1.0f / 1024;
+const float CHUNK_CODEC_SLOPE_STEP = 1.0f / 4096;
+
+const int CHUNK_CODEC_BLOCK_SIZE = 16;
+
+// The level, then three channels of the full resolution level with every
+//   block at full width, and slack for the packing's whole-word accesses
+const int CHUNK_CODEC_MAX_BYTES = 1 + 3 * (CHUNK_SIZE*CHUNK_SIZE / CHUNK_CODEC_BLOCK_SIZE) * (1 + CHUNK_CODEC_BLOCK_SIZE * 4) + 8;
+
+
+/// Compress maps valid from level lod into data, which must have room for
+///   CHUNK_CODEC_MAX_BYTES, returning the compressed size. Raises
+///   max_height_error and max_slope_error to the largest rounding error of level
+///   lod, which bounds the coarser levels' too.
+int
+encode_chunk_maps(int lod, const float *height_map, const vec2 *slope_map, uint8_t *data,
+                  float *max_height_error, float *max_slope_error);
+
+/// Decompress maps from encode_chunk_maps(), returning the level they are valid
+///   from.
+int
+decode_chunk_maps(const uint8_t *data, int size, float *height_map, vec2 *slope_map);
+
+
+#endif
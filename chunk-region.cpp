@@ -0,0 +1,361 @@
+#include "chunk-region.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static_assert(sizeof(ChunkRegionHeader) <= CHUNK_REGION_PAGE_SIZE, "Region header must fit its page");
+static_assert(sizeof(ChunkMaps) <= CHUNK_REGION_PAGE_SIZE, "Chunk maps must fit a region slot");
+
+const char CHUNK_REGION_EXTENSION[] = ".region";
+
+
+void
+get_region_path(const char *directory, int region_x, int region_y, char *path, int path_size)
+{
+  snprintf(path, path_size, "%s/%d.%d%s", directory, region_x, region_y, CHUNK_REGION_EXTENSION);
+}
+
+
+bool
+region_header_matches(const ChunkRegionHeader *header, uint64_t parameter_hash)
+{
+  return header->magic == CHUNK_REGION_MAGIC &&
+         header->version == CHUNK_REGION_VERSION &&
+         header->chunk_size == CHUNK_SIZE &&
+         header->n_lods == CHUNK_N_LODS &&
+         header->parameter_hash == parameter_hash;
+}
+
+
+ChunkMaps *
+get_region_slot(ChunkRegion *region, int chunk_n)
+{
+  return (ChunkMaps *)(region->map + CHUNK_REGION_PAGE_SIZE * (1 + chunk_n));
+}
+
+
+/// Map the region's file, creating it if create is set. Leaves the region's map
+///   0 if there is no file to map.
+void
+open_region(ChunkRegionStore *store, ChunkRegion *region, bool create)
+{
+  char path[320];
+  get_region_path(store->directory, region->x, region->y, path, sizeof(path));
+
+  region->map = 0;
+  region->dirty = false;
+  region->fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+  if (region->fd < 0)
+  {
+    return;
+  }
+
+  // Files of another size are stale, and only worth growing to store into
+  struct stat file_stat;
+  if (fstat(region->fd, &file_stat) != 0 ||
+      (file_stat.st_size != CHUNK_REGION_FILE_SIZE &&
+       (!create || ftruncate(region->fd, CHUNK_REGION_FILE_SIZE) != 0)))
+  {
+    close(region->fd);
+    region->fd = -1;
+    return;
+  }
+
+  void *map = mmap(0, CHUNK_REGION_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(region->fd);
+    region->fd = -1;
+    return;
+  }
+
+  region->map = (uint8_t *)map;
+}
+
+
+void
+close_region(ChunkRegion *region)
+{
+  if (region->map)
+  {
+    if (region->dirty)
+    {
+      msync(region->map, CHUNK_REGION_FILE_SIZE, MS_ASYNC);
+    }
+    munmap(region->map, CHUNK_REGION_FILE_SIZE);
+    close(region->fd);
+  }
+
+  region->map = 0;
+  region->fd = -1;
+}
+
+
+/// Return the region at region_x, region_y, opening it in place of the least
+///   recently used region if it is not open.
+ChunkRegion *
+get_region(ChunkRegionStore *store, int region_x, int region_y, bool create)
+{
+  ChunkRegion *region = 0;
+  for (int region_n = 0;
+       region_n < store->n_regions;
+       ++region_n)
+  {
+    if (store->regions[region_n].x == region_x &&
+        store->regions[region_n].y == region_y)
+    {
+      region = store->regions + region_n;
+      break;
+    }
+  }
+
+  if (!region)
+  {
+    if (store->n_regions < CHUNK_REGION_MAX_OPEN)
+    {
+      region = store->regions + store->n_regions++;
+    }
+    else
+    {
+      region = store->regions;
+      for (int region_n = 1;
+           region_n < store->n_regions;
+           ++region_n)
+      {
+        if (store->regions[region_n].last_used < region->last_used)
+        {
+          region = store->regions + region_n;
+        }
+      }
+      close_region(region);
+    }
+
+    region->x = region_x;
+    region->y = region_y;
+    open_region(store, region, create);
+  }
+  else if (!region->map && create)
+  {
+    open_region(store, region, create);
+  }
+
+  region->last_used = ++store->clock;
+  return region;
+}
+
+
+/// Find the region holding position, and the chunk's slot within it.
+void
+get_region_position(vec2 position, int *region_x, int *region_y, int *chunk_n)
+{
+  int chunk_x = (int)position.x;
+  int chunk_y = (int)position.y;
+  *region_x = (int)floorf(position.x / CHUNK_REGION_SIZE);
+  *region_y = (int)floorf(position.y / CHUNK_REGION_SIZE);
+  *chunk_n = (chunk_y - *region_y * CHUNK_REGION_SIZE) * CHUNK_REGION_SIZE + (chunk_x - *region_x * CHUNK_REGION_SIZE);
+}
+
+
+bool
+chunk_region_store_init(ChunkRegionStore *store, const char *directory)
+{
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+  {
+    return false;
+  }
+
+  snprintf(store->directory, sizeof(store->directory), "%s", directory);
+  store->n_regions = 0;
+  store->clock = 0;
+
+  store->n_loads = 0;
+  store->n_misses = 0;
+  store->n_stores = 0;
+  store->n_stale_regions = 0;
+
+  return true;
+}
+
+
+void
+chunk_region_store_free(ChunkRegionStore *store)
+{
+  for (int region_n = 0;
+       region_n < store->n_regions;
+       ++region_n)
+  {
+    close_region(store->regions + region_n);
+  }
+  store->n_regions = 0;
+}
+
+
+void
+chunk_region_store_flush(ChunkRegionStore *store)
+{
+  for (int region_n = 0;
+       region_n < store->n_regions;
+       ++region_n)
+  {
+    ChunkRegion &region = store->regions[region_n];
+    if (region.dirty)
+    {
+      msync(region.map, CHUNK_REGION_FILE_SIZE, MS_ASYNC);
+      region.dirty = false;
+    }
+  }
+}
+
+
+void
+chunk_region_store_clear(ChunkRegionStore *store)
+{
+  chunk_region_store_free(store);
+
+  DIR *dir = opendir(store->directory);
+  if (!dir)
+  {
+    return;
+  }
+
+  const int extension_length = sizeof(CHUNK_REGION_EXTENSION) - 1;
+  while (struct dirent *dir_entry = readdir(dir))
+  {
+    int name_length = strlen(dir_entry->d_name);
+    if (name_length > extension_length &&
+        strcmp(dir_entry->d_name + name_length - extension_length, CHUNK_REGION_EXTENSION) == 0)
+    {
+      char path[320];
+      snprintf(path, sizeof(path), "%s/%s", store->directory, dir_entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+
+const ChunkMaps *
+chunk_region_store_find(ChunkRegionStore *store, uint64_t parameter_hash, vec2 position, int lod, int *found_lod)
+{
+  int region_x, region_y, chunk_n;
+  get_region_position(position, &region_x, &region_y, &chunk_n);
+
+  ChunkRegion *region = get_region(store, region_x, region_y, false);
+  if (region->map)
+  {
+    const ChunkRegionHeader *header = (const ChunkRegionHeader *)region->map;
+    int stored_lod = header->chunk_lods[chunk_n] - 1;
+    if (region_header_matches(header, parameter_hash) &&
+        stored_lod >= 0 && stored_lod <= lod)
+    {
+      *found_lod = stored_lod;
+      ++store->n_loads;
+      return get_region_slot(region, chunk_n);
+    }
+  }
+
+  ++store->n_misses;
+  return 0;
+}
+
+
+int
+chunk_region_read(const char *directory, uint64_t parameter_hash, vec2 position, int lod, float *height_map, vec2 *slope_map)
+{
+  int region_x, region_y, chunk_n;
+  get_region_position(position, &region_x, &region_y, &chunk_n);
+
+  char path[320];
+  get_region_path(directory, region_x, region_y, path, sizeof(path));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  // Read through the page cache the store's mappings share, so chunks stored
+  //   by the main thread are seen before they are written back
+  ChunkRegionHeader header;
+  int stored_lod = -1;
+  if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      region_header_matches(&header, parameter_hash))
+  {
+    stored_lod = header.chunk_lods[chunk_n] - 1;
+  }
+
+  bool loaded = false;
+  if (stored_lod >= 0 && stored_lod <= lod)
+  {
+    off_t slot_offset = (off_t)CHUNK_REGION_PAGE_SIZE * (1 + chunk_n);
+    int first_cell_n = chunk_lod_offset(stored_lod);
+    ssize_t heights_size = (CHUNK_LOD_CELLS - first_cell_n) * sizeof(float);
+    ssize_t slopes_size = (CHUNK_LOD_CELLS - first_cell_n) * sizeof(vec2);
+    loaded = pread(fd, height_map + first_cell_n, heights_size,
+                 slot_offset + offsetof(ChunkMaps, height_map) + first_cell_n * sizeof(float)) == heights_size &&
+           pread(fd, slope_map + first_cell_n, slopes_size,
+                 slot_offset + offsetof(ChunkMaps, slope_map) + first_cell_n * sizeof(vec2)) == slopes_size;
+  }
+
+  close(fd);
+  return loaded ? stored_lod : -1;
+}
+
+
+void
+chunk_region_store_put(ChunkRegionStore *store, uint64_t parameter_hash, vec2 position, int lod, const float *height_map, const vec2 *slope_map)
+{
+  assert(parameter_hash != 0);
+
+  int region_x, region_y, chunk_n;
+  get_region_position(position, &region_x, &region_y, &chunk_n);
+
+  ChunkRegion *region = get_region(store, region_x, region_y, true);
+  if (!region->map)
+  {
+    return;
+  }
+
+  // Clearing the levels is enough to empty a stale region, the slots are only
+  //   read once stored into again
+  ChunkRegionHeader *header = (ChunkRegionHeader *)region->map;
+  if (!region_header_matches(header, parameter_hash))
+  {
+    if (header->magic != 0)
+    {
+      ++store->n_stale_regions;
+    }
+
+    memset(header, 0, sizeof(ChunkRegionHeader));
+    header->magic = CHUNK_REGION_MAGIC;
+    header->version = CHUNK_REGION_VERSION;
+    header->chunk_size = CHUNK_SIZE;
+    header->n_lods = CHUNK_N_LODS;
+    header->parameter_hash = parameter_hash;
+  }
+
+  int stored_lod = header->chunk_lods[chunk_n] - 1;
+  if (stored_lod >= 0 && stored_lod <= lod)
+  {
+    return;
+  }
+
+  ChunkMaps *slot = get_region_slot(region, chunk_n);
+  int first_cell_n = chunk_lod_offset(lod);
+  memcpy(slot->height_map + first_cell_n, height_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(float));
+  memcpy(slot->slope_map + first_cell_n, slope_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(vec2));
+  header->chunk_lods[chunk_n] = lod + 1;
+
+  region->dirty = true;
+  ++store->n_stores;
+}
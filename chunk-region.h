@@ -0,0 +1,123 @@
+#ifndef CHUNK_REGION_H_DEF
+#define CHUNK_REGION_H_DEF
+
+#include "chunk-table.h"
+#include <stdint.h>
+
+
+// Region files
+//
+// Generated chunks are kept on disk in region files of CHUNK_REGION_SIZE x
+//   CHUNK_REGION_SIZE chunks, so that terrain is not generated again when it is
+//   revisited after leaving the chunk cache, or after a restart. A file starts
+//   with a ChunkRegionHeader page followed by one page per chunk slot holding
+//   its ChunkMaps. The main thread finds and stores chunks through a shared
+//   mmap(), leaving stored chunks for the kernel to write back, and workers
+//   read the chunks found with chunk_region_read(), so the main thread never
+//   takes the page fault on a slot. Each header records the hash of the octave
+//   plan its chunks were generated from, and a region of another plan reads as
+//   empty until a chunk is stored into it, which clears it.
+//
+// Unlike the chunk cache, slots are not compressed. Loading a slot is already
+//   cheaper than decoding one, and a compressed chunk would still take a
+//   whole page of the file, as slots must not straddle pages.
+
+const int CHUNK_REGION_SIZE = 32;
+const int CHUNK_REGION_N_CHUNKS = CHUNK_REGION_SIZE * CHUNK_REGION_SIZE;
+
+const uint32_t CHUNK_REGION_MAGIC = 0x4e474552;
+const uint32_t CHUNK_REGION_VERSION = 1;
+
+// Header and chunk slots are page aligned, so a chunk load touches one page
+const int CHUNK_REGION_PAGE_SIZE = 4096;
+const int CHUNK_REGION_FILE_SIZE = CHUNK_REGION_PAGE_SIZE * (1 + CHUNK_REGION_N_CHUNKS);
+
+const int CHUNK_REGION_MAX_OPEN = 16;
+
+struct ChunkRegionHeader
+{
+  uint32_t magic;
+  uint32_t version;
+
+  // Layout the file was written with, a mismatch makes the whole file stale
+  int32_t chunk_size;
+  int32_t n_lods;
+
+  uint64_t parameter_hash;
+
+  // One more than the finest level of detail stored for each chunk, 0 where
+  //   the chunk has not been stored, so a new sparse file is all empty
+  uint8_t chunk_lods[CHUNK_REGION_N_CHUNKS];
+};
+
+/// An open region file, or a region known to have no file yet when map is 0.
+struct ChunkRegion
+{
+  int x;
+  int y;
+
+  int fd;
+  uint8_t *map;
+
+  // ChunkRegionStore::clock when the region was last used
+  uint32_t last_used;
+  bool dirty;
+};
+
+/// The region files in a directory, of which the CHUNK_REGION_MAX_OPEN most
+///   recently used are kept mapped. Only to be used from the main thread.
+struct ChunkRegionStore
+{
+  char directory[256];
+
+  ChunkRegion regions[CHUNK_REGION_MAX_OPEN];
+  int n_regions;
+
+  uint32_t clock;
+
+  // Stats, left for the caller to reset
+  uint64_t n_loads;
+  uint64_t n_misses;
+  uint64_t n_stores;
+  uint64_t n_stale_regions;
+};
+
+
+/// Returns false if the directory cannot be created, then there is no store.
+bool
+chunk_region_store_init(ChunkRegionStore *store, const char *directory);
+
+/// Close every region, leaving their dirty pages for the kernel to write back.
+void
+chunk_region_store_free(ChunkRegionStore *store);
+
+/// Start writing back the regions stored into since the last flush, without
+///   waiting for it to finish.
+void
+chunk_region_store_flush(ChunkRegionStore *store);
+
+/// Delete every region file in the store's directory.
+void
+chunk_region_store_clear(ChunkRegionStore *store);
+
+/// Return the maps of position generated from parameter_hash at level lod or
+///   finer, setting found_lod to the finest level held, or 0 if there are none.
+///   The maps point into the region's mapping, so are only valid until the next
+///   call on the store.
+const ChunkMaps *
+chunk_region_store_find(ChunkRegionStore *store, uint64_t parameter_hash, vec2 position, int lod, int *found_lod);
+
+/// Read the maps of position generated from parameter_hash at level lod or
+///   finer from its region file in directory, as chunk_region_store_find()
+///   finds them, returning the finest level read, or -1 if the file does not
+///   hold the chunk. Does not use the store, so is safe from any thread.
+int
+chunk_region_read(const char *directory, uint64_t parameter_hash, vec2 position, int lod, float *height_map, vec2 *slope_map);
+
+/// Copy maps valid from level lod into the chunk's region file, creating it if
+///   needed, unless it already holds the chunk at lod or finer.
+void
+chunk_region_store_put(ChunkRegionStore *store, uint64_t parameter_hash, vec2 position, int lod, const float *height_map, const vec2 *slope_map);
+
+
+#endif
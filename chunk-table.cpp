@@ -0,0 +1,606 @@
+#include "chunk-table.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Grow once more than half the slots are occupied, keeping probe chains short
+const float CHUNK_TABLE_MAX_LOAD = 0.5;
+
+const int CACHE_LINE_SIZE = 64;
+
+
+void *
+calloc_cache_aligned(size_t n, size_t size)
+{
+  void *result = 0;
+  if (posix_memalign(&result, CACHE_LINE_SIZE, n * size) != 0)
+  {
+    return 0;
+  }
+  memset(result, 0, n * size);
+  return result;
+}
+
+
+void
+build_chunk_lods(int lod, float *height_map, vec2 *slope_map)
+{
+  for (int level = lod + 1;
+       level < CHUNK_N_LODS;
+       ++level)
+  {
+    int size = chunk_lod_size(level);
+    int finer_size = chunk_lod_size(level - 1);
+
+    float *heights = height_map + chunk_lod_offset(level);
+    vec2 *slopes = slope_map + chunk_lod_offset(level);
+    const float *finer_heights = height_map + chunk_lod_offset(level - 1);
+    const vec2 *finer_slopes = slope_map + chunk_lod_offset(level - 1);
+
+    for (int y = 0;
+         y < size;
+         ++y)
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      int finer_n = 2*y * finer_size + 2*x;
+      heights[y*size + x] = 0.25f * (finer_heights[finer_n] + finer_heights[finer_n + 1] +
+                                     finer_heights[finer_n + finer_size] + finer_heights[finer_n + finer_size + 1]);
+
+      vec2 slope = vec2Add(vec2Add(finer_slopes[finer_n], finer_slopes[finer_n + 1]),
+                           vec2Add(finer_slopes[finer_n + finer_size], finer_slopes[finer_n + finer_size + 1]));
+      slopes[y*size + x] = vec2Multiply(slope, 0.25f);
+    }
+  }
+}
+
+
+/// Fill level_mins and level_maxes, of SIZE x SIZE cubes, with the bounds of
+///   each 2x2 cubes of the finer level's. SIZE is fixed so the loops unroll.
+template <int SIZE>
+void
+reduce_chunk_bounds(const float *finer_mins, const float *finer_maxes, float *level_mins, float *level_maxes)
+{
+  const int size = SIZE;
+  const int finer_size = 2*size;
+  for (int y = 0;
+       y < size;
+       ++y)
+  {
+    // Down the columns first, which vectorises, then across pairs of columns
+    const float *finer_mins_row = finer_mins + 2*y * finer_size;
+    const float *finer_maxes_row = finer_maxes + 2*y * finer_size;
+    float column_mins[CHUNK_SIZE];
+    float column_maxes[CHUNK_SIZE];
+    for (int x = 0;
+         x < finer_size;
+         ++x)
+    {
+      column_mins[x] = fminf(finer_mins_row[x], finer_mins_row[finer_size + x]);
+      column_maxes[x] = fmaxf(finer_maxes_row[x], finer_maxes_row[finer_size + x]);
+    }
+
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      level_mins[y*size + x] = fminf(column_mins[2*x], column_mins[2*x + 1]);
+      level_maxes[y*size + x] = fmaxf(column_maxes[2*x], column_maxes[2*x + 1]);
+    }
+  }
+}
+
+
+typedef void (*ReduceChunkBoundsKernel)(const float *finer_mins, const float *finer_maxes, float *level_mins, float *level_maxes);
+
+// Indexed by the level reduced to
+const ReduceChunkBoundsKernel REDUCE_CHUNK_BOUNDS[CHUNK_N_LODS] = {
+  0,
+  reduce_chunk_bounds<(CHUNK_SIZE >> 1)>,
+  reduce_chunk_bounds<(CHUNK_SIZE >> 2)>,
+  reduce_chunk_bounds<(CHUNK_SIZE >> 3)>,
+  reduce_chunk_bounds<(CHUNK_SIZE >> 4)>
+};
+
+
+#if defined(__SSE2__)
+/// The bounds of four 2x2 cubes, from two rows of eight finer cubes: row_0_0
+///   and row_0_1 the first row's halves, row_1_0 and row_1_1 the second's.
+__m128
+reduce_mins_2x2(__m128 row_0_0, __m128 row_0_1, __m128 row_1_0, __m128 row_1_1)
+{
+  __m128 columns_0 = _mm_min_ps(row_0_0, row_1_0);
+  __m128 columns_1 = _mm_min_ps(row_0_1, row_1_1);
+  return _mm_min_ps(_mm_shuffle_ps(columns_0, columns_1, _MM_SHUFFLE(2, 0, 2, 0)),
+                    _mm_shuffle_ps(columns_0, columns_1, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+
+__m128
+reduce_maxes_2x2(__m128 row_0_0, __m128 row_0_1, __m128 row_1_0, __m128 row_1_1)
+{
+  __m128 columns_0 = _mm_max_ps(row_0_0, row_1_0);
+  __m128 columns_1 = _mm_max_ps(row_0_1, row_1_1);
+  return _mm_max_ps(_mm_shuffle_ps(columns_0, columns_1, _MM_SHUFFLE(2, 0, 2, 0)),
+                    _mm_shuffle_ps(columns_0, columns_1, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+
+/// The pyramid of a chunk stored at full resolution, in a single pass over its
+///   heights. Each level is reduced from the one before it while that is still
+///   in registers, where going through memory level by level would leave every
+///   level waiting on the stores of the last, and cost as much again.
+void
+build_full_resolution_chunk_bounds(const float *heights, float *min_heights, float *max_heights)
+{
+  static_assert(CHUNK_SIZE == 16 && CHUNK_N_LODS == 5, "Pyramid is reduced for 16x16 chunks");
+
+  __m128 level_2_mins[4];
+  __m128 level_2_maxes[4];
+  for (int y = 0;
+       y < 4;
+       ++y)
+  {
+    // Level 1 rows 2y and 2y + 1, each in two halves
+    __m128 level_1_mins[2][2];
+    __m128 level_1_maxes[2][2];
+    for (int row_n = 0;
+         row_n < 2;
+         ++row_n)
+    for (int half_n = 0;
+         half_n < 2;
+         ++half_n)
+    {
+      const float *cubes = heights + (4*y + 2*row_n) * CHUNK_SIZE + 8*half_n;
+      __m128 row_0_0 = _mm_loadu_ps(cubes);
+      __m128 row_0_1 = _mm_loadu_ps(cubes + 4);
+      __m128 row_1_0 = _mm_loadu_ps(cubes + CHUNK_SIZE);
+      __m128 row_1_1 = _mm_loadu_ps(cubes + CHUNK_SIZE + 4);
+      level_1_mins[row_n][half_n] = reduce_mins_2x2(row_0_0, row_0_1, row_1_0, row_1_1);
+      level_1_maxes[row_n][half_n] = reduce_maxes_2x2(row_0_0, row_0_1, row_1_0, row_1_1);
+
+      int level_1_n = chunk_bounds_offset(1) + (2*y + row_n) * 8 + 4*half_n;
+      _mm_storeu_ps(min_heights + level_1_n, level_1_mins[row_n][half_n]);
+      _mm_storeu_ps(max_heights + level_1_n, level_1_maxes[row_n][half_n]);
+    }
+
+    level_2_mins[y] = reduce_mins_2x2(level_1_mins[0][0], level_1_mins[0][1], level_1_mins[1][0], level_1_mins[1][1]);
+    level_2_maxes[y] = reduce_maxes_2x2(level_1_maxes[0][0], level_1_maxes[0][1], level_1_maxes[1][0], level_1_maxes[1][1]);
+    _mm_storeu_ps(min_heights + chunk_bounds_offset(2) + 4*y, level_2_mins[y]);
+    _mm_storeu_ps(max_heights + chunk_bounds_offset(2) + 4*y, level_2_maxes[y]);
+  }
+
+  // Level 2's rows are four cubes, so pairs of rows fill both halves, which
+  //   leaves level 3's four cubes in order
+  __m128 level_3_mins = reduce_mins_2x2(level_2_mins[0], level_2_mins[2], level_2_mins[1], level_2_mins[3]);
+  __m128 level_3_maxes = reduce_maxes_2x2(level_2_maxes[0], level_2_maxes[2], level_2_maxes[1], level_2_maxes[3]);
+  _mm_storeu_ps(min_heights + chunk_bounds_offset(3), level_3_mins);
+  _mm_storeu_ps(max_heights + chunk_bounds_offset(3), level_3_maxes);
+
+  __m128 level_4_mins = _mm_min_ps(level_3_mins, _mm_movehl_ps(level_3_mins, level_3_mins));
+  __m128 level_4_maxes = _mm_max_ps(level_3_maxes, _mm_movehl_ps(level_3_maxes, level_3_maxes));
+  level_4_mins = _mm_min_ps(level_4_mins, _mm_shuffle_ps(level_4_mins, level_4_mins, _MM_SHUFFLE(1, 1, 1, 1)));
+  level_4_maxes = _mm_max_ps(level_4_maxes, _mm_shuffle_ps(level_4_maxes, level_4_maxes, _MM_SHUFFLE(1, 1, 1, 1)));
+  _mm_store_ss(min_heights + chunk_bounds_offset(4), level_4_mins);
+  _mm_store_ss(max_heights + chunk_bounds_offset(4), level_4_maxes);
+}
+#endif
+
+
+void
+build_chunk_bounds(TerrainChunk *terrain_chunk, int lod)
+{
+  // Quantised heights are reduced as stored, and scaled after, which keeps
+  //   their order as scales are never negative
+  int size = chunk_lod_size(lod);
+  const ChunkHeight *stored_heights = terrain_chunk->height_map + chunk_lod_offset(lod);
+#ifdef QUANTISE_HEIGHTS
+  float heights[CHUNK_SIZE*CHUNK_SIZE];
+  for (int cell_n = 0;
+       cell_n < size*size;
+       ++cell_n)
+  {
+    heights[cell_n] = stored_heights[cell_n];
+  }
+#else
+  const float *heights = stored_heights;
+#endif
+
+  // Level 0 is the height map itself, so has no cells in the pyramid
+  if (lod > 0)
+  {
+    memcpy(terrain_chunk->min_heights + chunk_bounds_offset(lod), heights, size*size * sizeof(float));
+    memcpy(terrain_chunk->max_heights + chunk_bounds_offset(lod), heights, size*size * sizeof(float));
+  }
+
+#if defined(__SSE2__)
+  if (lod == 0)
+  {
+    build_full_resolution_chunk_bounds(heights, terrain_chunk->min_heights, terrain_chunk->max_heights);
+  }
+  else
+#endif
+  {
+    const float *finer_mins = heights;
+    const float *finer_maxes = heights;
+    for (int level = lod + 1;
+         level < CHUNK_N_LODS;
+         ++level)
+    {
+      float *mins = terrain_chunk->min_heights + chunk_bounds_offset(level);
+      float *maxes = terrain_chunk->max_heights + chunk_bounds_offset(level);
+      REDUCE_CHUNK_BOUNDS[level](finer_mins, finer_maxes, mins, maxes);
+      finer_mins = mins;
+      finer_maxes = maxes;
+    }
+  }
+
+#ifdef QUANTISE_HEIGHTS
+  int first_cell_n = chunk_bounds_offset(lod > 0 ? lod : 1);
+  for (int cell_n = first_cell_n;
+       cell_n < CHUNK_BOUNDS_CELLS;
+       ++cell_n)
+  {
+    terrain_chunk->min_heights[cell_n] = terrain_chunk->height_base + terrain_chunk->height_scale * terrain_chunk->min_heights[cell_n];
+    terrain_chunk->max_heights[cell_n] = terrain_chunk->height_base + terrain_chunk->height_scale * terrain_chunk->max_heights[cell_n];
+  }
+#endif
+
+  // The coarsest level is a single cube
+  terrain_chunk->min_height = terrain_chunk->min_heights[CHUNK_BOUNDS_CELLS - 1];
+  terrain_chunk->max_height = terrain_chunk->max_heights[CHUNK_BOUNDS_CELLS - 1];
+}
+
+
+void
+store_chunk_maps(TerrainChunk *terrain_chunk, int lod, const float *height_map, const vec2 *slope_map,
+                 float *max_height_error, float *max_slope_error)
+{
+  int first_cell_n = chunk_lod_offset(lod);
+
+#ifdef QUANTISE_HEIGHTS
+  float min_height = height_map[first_cell_n];
+  float max_height = height_map[first_cell_n];
+  float max_slope = 0;
+  for (int cell_n = first_cell_n;
+       cell_n < CHUNK_LOD_CELLS;
+       ++cell_n)
+  {
+    min_height = fminf(min_height, height_map[cell_n]);
+    max_height = fmaxf(max_height, height_map[cell_n]);
+    max_slope = fmaxf(max_slope, fmaxf(fabsf(slope_map[cell_n].x), fabsf(slope_map[cell_n].y)));
+  }
+
+  // Heights span the whole int16 range, slopes are symmetric about 0
+  float height_scale = (max_height - min_height) / UINT16_MAX;
+  float slope_scale = max_slope / INT16_MAX;
+  float inv_height_scale = height_scale > 0 ? 1/height_scale : 0;
+  float inv_slope_scale = slope_scale > 0 ? 1/slope_scale : 0;
+
+  terrain_chunk->height_base = min_height - INT16_MIN*height_scale;
+  terrain_chunk->height_scale = height_scale;
+  terrain_chunk->slope_scale = slope_scale;
+
+  for (int cell_n = 0;
+       cell_n < first_cell_n;
+       ++cell_n)
+  {
+    terrain_chunk->height_map[cell_n] = 0;
+    terrain_chunk->slope_map[cell_n] = {};
+  }
+  for (int cell_n = first_cell_n;
+       cell_n < CHUNK_LOD_CELLS;
+       ++cell_n)
+  {
+    terrain_chunk->height_map[cell_n] = INT16_MIN + lroundf((height_map[cell_n] - min_height) * inv_height_scale);
+    terrain_chunk->slope_map[cell_n] = {(int16_t)lroundf(slope_map[cell_n].x * inv_slope_scale),
+                                        (int16_t)lroundf(slope_map[cell_n].y * inv_slope_scale)};
+  }
+#else
+  terrain_chunk->height_base = 0;
+  terrain_chunk->height_scale = 1;
+  terrain_chunk->slope_scale = 1;
+  memcpy(terrain_chunk->height_map + first_cell_n, height_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(float));
+  memcpy(terrain_chunk->slope_map + first_cell_n, slope_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(vec2));
+#endif
+
+  for (int cell_n = first_cell_n;
+       cell_n < CHUNK_LOD_CELLS;
+       ++cell_n)
+  {
+    *max_height_error = fmaxf(*max_height_error, fabsf(get_chunk_height(*terrain_chunk, cell_n) - height_map[cell_n]));
+    *max_slope_error = fmaxf(*max_slope_error, vec2Length(vec2Subtract(get_chunk_slope(*terrain_chunk, cell_n), slope_map[cell_n])));
+  }
+
+  build_chunk_bounds(terrain_chunk, lod);
+}
+
+
+#ifdef CHUNK_HALO
+/// Index of the cube covering the full resolution cube x, y in the chunk's
+///   finest level.
+int
+get_chunk_cube_index(const TerrainChunk &terrain_chunk, int x, int y)
+{
+  int lod = terrain_chunk.lod;
+  return chunk_lod_offset(lod) + (y >> lod) * chunk_lod_size(lod) + (x >> lod);
+}
+
+
+void
+fill_chunk_halo(TerrainChunk *terrain_chunk, const TerrainChunk *neighbour, int neighbour_x, int neighbour_y)
+{
+  bool neighbour_ready = neighbour && neighbour->ready;
+
+  // The ring's cells along the neighbour's side, or at its corner
+  int first_x = neighbour_x < 0 ? -1 : neighbour_x > 0 ? CHUNK_SIZE : 0;
+  int last_x = neighbour_x < 0 ? -1 : neighbour_x > 0 ? CHUNK_SIZE : CHUNK_SIZE - 1;
+  int first_y = neighbour_y < 0 ? -1 : neighbour_y > 0 ? CHUNK_SIZE : 0;
+  int last_y = neighbour_y < 0 ? -1 : neighbour_y > 0 ? CHUNK_SIZE : CHUNK_SIZE - 1;
+
+  for (int y = first_y;
+       y <= last_y;
+       ++y)
+  for (int x = first_x;
+       x <= last_x;
+       ++x)
+  {
+    int halo_n = chunk_halo_index(x, y);
+    if (neighbour_ready)
+    {
+      int cell_n = get_chunk_cube_index(*neighbour, x - neighbour_x*CHUNK_SIZE, y - neighbour_y*CHUNK_SIZE);
+      terrain_chunk->halo_heights[halo_n] = get_chunk_height(*neighbour, cell_n);
+      terrain_chunk->halo_slopes[halo_n] = get_chunk_slope(*neighbour, cell_n);
+    }
+    else
+    {
+      int cell_n = get_chunk_cube_index(*terrain_chunk, std::min(std::max(x, 0), CHUNK_SIZE - 1),
+                                        std::min(std::max(y, 0), CHUNK_SIZE - 1));
+      terrain_chunk->halo_heights[halo_n] = get_chunk_height(*terrain_chunk, cell_n);
+      terrain_chunk->halo_slopes[halo_n] = get_chunk_slope(*terrain_chunk, cell_n);
+    }
+  }
+}
+
+
+void
+get_chunk_padded_heights(const TerrainChunk &terrain_chunk, float *heights)
+{
+  for (int x = 0;
+       x < CHUNK_HALO_SIZE;
+       ++x)
+  {
+    heights[x] = terrain_chunk.halo_heights[chunk_halo_index(x - 1, -1)];
+    heights[(CHUNK_HALO_SIZE - 1)*CHUNK_HALO_SIZE + x] = terrain_chunk.halo_heights[chunk_halo_index(x - 1, CHUNK_SIZE)];
+  }
+
+  for (int y = 0;
+       y < CHUNK_SIZE;
+       ++y)
+  {
+    float *row = heights + (y + 1)*CHUNK_HALO_SIZE;
+    row[0] = terrain_chunk.halo_heights[chunk_halo_index(-1, y)];
+    for (int x = 0;
+         x < CHUNK_SIZE;
+         ++x)
+    {
+      row[x + 1] = get_chunk_height(terrain_chunk, get_chunk_cube_index(terrain_chunk, x, y));
+    }
+    row[CHUNK_HALO_SIZE - 1] = terrain_chunk.halo_heights[chunk_halo_index(CHUNK_SIZE, y)];
+  }
+}
+#endif
+
+
+uint32_t
+chunk_position_hash(vec2 position)
+{
+  uint32_t hash = ((uint32_t)(int)position.x * 0x9e3779b1) ^ ((uint32_t)(int)position.y * 0x85ebca77);
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6d;
+  hash ^= hash >> 12;
+  return hash;
+}
+
+
+bool
+slot_occupied(ChunkTable *table, int slot_n)
+{
+  return table->keys[slot_n].terrain_gen_id == table->terrain_gen_id;
+}
+
+
+int
+home_slot(ChunkTable *table, vec2 position)
+{
+  return chunk_position_hash(position) & (table->capacity - 1);
+}
+
+
+void
+chunk_table_init(ChunkTable *table, int capacity)
+{
+  assert((capacity & (capacity - 1)) == 0);
+
+  // terrain_gen_id 0 marks slots which have never been claimed
+  table->keys = (ChunkKey *)calloc_cache_aligned(capacity, sizeof(ChunkKey));
+  table->chunks = (TerrainChunk *)calloc_cache_aligned(capacity, sizeof(TerrainChunk));
+  table->capacity = capacity;
+  table->n_chunks = 0;
+  table->max_load = CHUNK_TABLE_MAX_LOAD;
+  table->terrain_gen_id = 1;
+
+  table->n_lookups = 0;
+  table->n_probes = 0;
+  table->max_probe_length = 0;
+}
+
+
+void
+chunk_table_free(ChunkTable *table)
+{
+  for (int slot_n = 0;
+       slot_n < table->capacity;
+       ++slot_n)
+  {
+    if (table->chunks[slot_n].height_buffer)
+    {
+      glDeleteBuffers(1, &table->chunks[slot_n].height_buffer);
+    }
+  }
+
+  free(table->keys);
+  free(table->chunks);
+  table->keys = 0;
+  table->chunks = 0;
+  table->capacity = 0;
+  table->n_chunks = 0;
+}
+
+
+void
+chunk_table_clear(ChunkTable *table)
+{
+  table->terrain_gen_id++;
+  table->n_chunks = 0;
+}
+
+
+/// Find the slot holding position, or the empty slot ending its probe chain.
+///   Only reads keys.
+int
+probe(ChunkTable *table, vec2 position)
+{
+  int slot_n = home_slot(table, position);
+  int probe_length = 1;
+
+  while (slot_occupied(table, slot_n) && !vec2Equal(table->keys[slot_n].position, position))
+  {
+    slot_n = (slot_n + 1) & (table->capacity - 1);
+    ++probe_length;
+  }
+
+  table->n_lookups++;
+  table->n_probes += probe_length;
+  if (probe_length > table->max_probe_length)
+  {
+    table->max_probe_length = probe_length;
+  }
+
+  return slot_n;
+}
+
+
+void
+grow(ChunkTable *table)
+{
+  ChunkKey *old_keys = table->keys;
+  TerrainChunk *old_chunks = table->chunks;
+  int old_capacity = table->capacity;
+
+  table->capacity *= 2;
+  table->keys = (ChunkKey *)calloc_cache_aligned(table->capacity, sizeof(ChunkKey));
+  table->chunks = (TerrainChunk *)calloc_cache_aligned(table->capacity, sizeof(TerrainChunk));
+
+  for (int slot_n = 0;
+       slot_n < old_capacity;
+       ++slot_n)
+  {
+    if (old_keys[slot_n].terrain_gen_id == table->terrain_gen_id)
+    {
+      int new_slot_n = probe(table, old_keys[slot_n].position);
+      table->keys[new_slot_n] = old_keys[slot_n];
+      table->chunks[new_slot_n] = old_chunks[slot_n];
+    }
+    else if (old_chunks[slot_n].height_buffer)
+    {
+      glDeleteBuffers(1, &old_chunks[slot_n].height_buffer);
+    }
+  }
+
+  free(old_keys);
+  free(old_chunks);
+}
+
+
+TerrainChunk *
+chunk_table_find(ChunkTable *table, vec2 position)
+{
+  int slot_n = probe(table, position);
+  return slot_occupied(table, slot_n) ? table->chunks + slot_n : 0;
+}
+
+
+TerrainChunk &
+chunk_table_get(ChunkTable *table, vec2 position, bool *new_chunk)
+{
+  int slot_n = probe(table, position);
+
+  bool claimed = !slot_occupied(table, slot_n);
+  if (claimed)
+  {
+    if (table->n_chunks + 1 > table->capacity * table->max_load)
+    {
+      grow(table);
+      slot_n = probe(table, position);
+    }
+
+    table->keys[slot_n].position = position;
+    table->keys[slot_n].terrain_gen_id = table->terrain_gen_id;
+    table->chunks[slot_n].ready = false;
+    table->n_chunks++;
+  }
+
+  if (new_chunk)
+  {
+    *new_chunk = claimed;
+  }
+
+  return table->chunks[slot_n];
+}
+
+
+void
+chunk_table_remove(ChunkTable *table, TerrainChunk *terrain_chunk)
+{
+  int hole = terrain_chunk - table->chunks;
+  assert(slot_occupied(table, hole));
+
+  // Backward-shift deletion: pull later chunks of the probe chain into the
+  //   hole until the chain ends, so lookups never need tombstones. Chunks are
+  //   swapped rather than copied so every slot keeps a GL buffer.
+  int slot_n = hole;
+  while (true)
+  {
+    slot_n = (slot_n + 1) & (table->capacity - 1);
+    if (!slot_occupied(table, slot_n))
+    {
+      break;
+    }
+
+    // A chunk can move back into the hole only if its home slot is not
+    //   cyclically within (hole, slot_n].
+    int home = home_slot(table, table->keys[slot_n].position);
+    bool stays = hole <= slot_n ? (hole < home && home <= slot_n)
+                                : (hole < home || home <= slot_n);
+    if (!stays)
+    {
+      std::swap(table->keys[hole], table->keys[slot_n]);
+      std::swap(table->chunks[hole], table->chunks[slot_n]);
+      hole = slot_n;
+    }
+  }
+
+  table->keys[hole].terrain_gen_id = 0;
+  table->n_chunks--;
+}
@@ -0,0 +1,291 @@
+#ifndef CHUNK_TABLE_H_DEF
+#define CHUNK_TABLE_H_DEF
+
+#include "ccVector.h"
+#include <GL/gl3w.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+const int CHUNK_SIZE = 16;
+
+// Levels of detail of a chunk, level l being (CHUNK_SIZE >> l) cubes a side
+const int CHUNK_N_LODS = 5;
+
+// Cubes in every level of detail together
+const int CHUNK_LOD_CELLS = (CHUNK_SIZE*CHUNK_SIZE * 4 - 1) / 3;
+
+
+inline int
+chunk_lod_size(int lod)
+{
+  return CHUNK_SIZE >> lod;
+}
+
+
+/// Where level lod starts in a chunk's height and slope maps.
+inline int
+chunk_lod_offset(int lod)
+{
+  int offset = 0;
+  for (int level = 0;
+       level < lod;
+       ++level)
+  {
+    offset += chunk_lod_size(level) * chunk_lod_size(level);
+  }
+  return offset;
+}
+
+
+// Cells of the min/max height pyramid, every level of detail but the finest
+const int CHUNK_BOUNDS_CELLS = CHUNK_LOD_CELLS - CHUNK_SIZE*CHUNK_SIZE;
+
+
+/// Where level lod starts in a chunk's min/max height pyramid, for lod > 0.
+inline int
+chunk_bounds_offset(int lod)
+{
+  return chunk_lod_offset(lod) - CHUNK_SIZE*CHUNK_SIZE;
+}
+
+
+// Chunk height storage
+//
+// With QUANTISE_HEIGHTS defined, heights and slopes are stored as 16-bit
+//   integers scaled per chunk, halving the chunk stores and their GPU copies.
+//   Otherwise they are the generated floats, with a base of 0 and scales of 1.
+
+#ifdef QUANTISE_HEIGHTS
+struct QuantisedSlope
+{
+  int16_t x;
+  int16_t y;
+};
+
+typedef int16_t ChunkHeight;
+typedef QuantisedSlope ChunkSlope;
+const GLenum CHUNK_MAP_GL_TYPE = GL_SHORT;
+#else
+typedef float ChunkHeight;
+typedef vec2 ChunkSlope;
+const GLenum CHUNK_MAP_GL_TYPE = GL_FLOAT;
+#endif
+
+
+// Chunk halos
+//
+// With CHUNK_HALO defined, each chunk also carries a ring one full resolution
+//   cube wide of its neighbours' heights and slopes. Passes reading a cube's
+//   neighbours then read the border cubes' from the chunk as they do the
+//   interior cubes', instead of looking up the neighbouring chunks per cube.
+//   The ring is filled when the chunk is stored, which also copies the chunk's
+//   edges into its neighbours' rings, see fill_chunk_halo().
+
+// Full resolution cubes a side of a chunk with its halo, and cubes in the ring
+const int CHUNK_HALO_SIZE = CHUNK_SIZE + 2;
+const int CHUNK_HALO_CELLS = CHUNK_HALO_SIZE*CHUNK_HALO_SIZE - CHUNK_SIZE*CHUNK_SIZE;
+
+
+/// Index into a chunk's halo of the full resolution cube x, y relative to the
+///   chunk, which must be just outside it. The rows below and above the chunk
+///   come first, corners included, then the columns left and right of it.
+inline int
+chunk_halo_index(int x, int y)
+{
+  if (y < 0)
+  {
+    return x + 1;
+  }
+  else if (y >= CHUNK_SIZE)
+  {
+    return CHUNK_HALO_SIZE + x + 1;
+  }
+  else
+  {
+    return 2*CHUNK_HALO_SIZE + (x < 0 ? 0 : CHUNK_SIZE) + y;
+  }
+}
+
+
+/// Identifies the chunk in a slot of a chunk store. Keys are kept apart from
+///   the chunks so that probing and iterating a store only reads keys, four to
+///   a cache line, instead of striding over whole height maps.
+struct alignas(16) ChunkKey
+{
+  vec2 position;
+  int terrain_gen_id;
+};
+
+struct TerrainChunk
+{
+  // False from when the slot is claimed until its height map has been generated
+  bool ready;
+
+  // Every level of detail, finest first, see chunk_lod_offset(). Each cube of
+  //   a level averages 2x2 cubes of the level before it, so the first
+  //   CHUNK_SIZE*CHUNK_SIZE entries are the full resolution height map. Rows
+  //   and pyramid levels are read four cubes at a time, so start aligned.
+  alignas(16) ChunkHeight height_map[CHUNK_LOD_CELLS];
+
+  // The terrain's gradient (dh/dx, dh/dz) at each cube, from the noise's
+  //   analytic derivatives
+  ChunkSlope slope_map[CHUNK_LOD_CELLS];
+
+  // Height n is height_base + height_scale * height_map[n], and slope n is
+  //   slope_scale * slope_map[n]
+  float height_base;
+  float height_scale;
+  float slope_scale;
+
+  // Lowest and highest stored height under each cube of levels 1 and coarser,
+  //   see chunk_bounds_offset(), built by build_chunk_bounds(). Levels finer
+  //   than lod are unset, and level lod holds the heights themselves.
+  alignas(16) float min_heights[CHUNK_BOUNDS_CELLS];
+  alignas(16) float max_heights[CHUNK_BOUNDS_CELLS];
+
+  // Lowest and highest stored height of the whole chunk
+  float min_height;
+  float max_height;
+
+  // Finest level generated, levels finer than it are left unset. Far chunks
+  //   are generated coarse, and again at requested_lod as the camera nears.
+  int lod;
+  int requested_lod;
+
+  // Level drawn last frame, see update_render_lod()
+  int render_lod;
+
+  // Per-cube instance data, the height map followed by the slope map, uploaded
+  //   lazily by the render loop
+  GLuint height_buffer;
+  bool height_buffer_dirty;
+
+  // Cells [dirty_cells_start, dirty_cells_end) of the finest level, and every
+  //   coarser level, changed by terrain edits since the buffer was uploaded
+  int dirty_cells_start;
+  int dirty_cells_end;
+
+#ifdef CHUNK_HALO
+  // The cubes around the chunk, see chunk_halo_index(), as its neighbours
+  //   hold them at their finest level, or the chunk's nearest edge cubes
+  //   where a neighbour is not ready
+  float halo_heights[CHUNK_HALO_CELLS];
+  vec2 halo_slopes[CHUNK_HALO_CELLS];
+#endif
+};
+
+/// Open-addressing hashmap of chunks keyed by chunk position, with linear
+///   probing. Slot n's key is keys[n] and its chunk is chunks[n]. A slot is
+///   occupied when its key's terrain_gen_id is the table's, so bumping the
+///   table's terrain_gen_id empties it in O(1). Slots keep their GL buffers
+///   while empty, for the next chunk claiming them to reuse.
+struct ChunkTable
+{
+  ChunkKey *keys;
+  TerrainChunk *chunks;
+  int capacity;
+  int n_chunks;
+
+  // Load factor above which the table grows
+  float max_load;
+
+  int terrain_gen_id;
+
+  // Stats, left for the caller to reset
+  uint64_t n_lookups;
+  uint64_t n_probes;
+  int max_probe_length;
+};
+
+
+/// A chunk's generated maps of every level of detail, as laid out in
+///   TerrainChunk.
+struct ChunkMaps
+{
+  float height_map[CHUNK_LOD_CELLS];
+  vec2 slope_map[CHUNK_LOD_CELLS];
+};
+
+
+/// Fill the levels of detail coarser than lod by averaging, level lod having
+///   been generated.
+void
+build_chunk_lods(int lod, float *height_map, vec2 *slope_map);
+
+/// Build the chunk's min/max height pyramid from its stored heights of level
+///   lod and coarser.
+void
+build_chunk_bounds(TerrainChunk *terrain_chunk, int lod);
+
+/// Store generated maps, valid from level lod, into the chunk, and build its
+///   min/max height pyramid. Raises
+///   max_height_error and max_slope_error to the largest difference between
+///   the stored and generated values.
+void
+store_chunk_maps(TerrainChunk *terrain_chunk, int lod, const float *height_map, const vec2 *slope_map,
+                 float *max_height_error, float *max_slope_error);
+
+
+inline float
+get_chunk_height(const TerrainChunk &terrain_chunk, int cell_n)
+{
+  return terrain_chunk.height_base + terrain_chunk.height_scale * terrain_chunk.height_map[cell_n];
+}
+
+
+inline vec2
+get_chunk_slope(const TerrainChunk &terrain_chunk, int cell_n)
+{
+  const ChunkSlope &slope = terrain_chunk.slope_map[cell_n];
+  return {terrain_chunk.slope_scale * slope.x, terrain_chunk.slope_scale * slope.y};
+}
+
+
+#ifdef CHUNK_HALO
+/// Fill the cells of the chunk's halo facing the neighbour chunk at offset
+///   neighbour_x, neighbour_y from it, each -1, 0 or 1, from the neighbour, or
+///   from the chunk's own edge if neighbour is 0 or not ready.
+void
+fill_chunk_halo(TerrainChunk *terrain_chunk, const TerrainChunk *neighbour, int neighbour_x, int neighbour_y);
+
+/// Fill the CHUNK_HALO_SIZE x CHUNK_HALO_SIZE heights of the chunk's full
+///   resolution cubes and its halo around them, row by row from the cube
+///   below and left of the chunk.
+void
+get_chunk_padded_heights(const TerrainChunk &terrain_chunk, float *heights);
+#endif
+
+/// Hash of a chunk position, for picking a chunk store slot.
+uint32_t
+chunk_position_hash(vec2 position);
+
+/// calloc() for chunk store arrays, aligned to a cache line.
+void *
+calloc_cache_aligned(size_t n, size_t size);
+
+void
+chunk_table_init(ChunkTable *table, int capacity);
+
+void
+chunk_table_free(ChunkTable *table);
+
+/// Empty the table by starting a new terrain_gen_id.
+void
+chunk_table_clear(ChunkTable *table);
+
+/// Return the chunk at position, or 0 if it is not in the table.
+TerrainChunk *
+chunk_table_find(ChunkTable *table, vec2 position);
+
+/// Return the chunk at position, claiming a slot for it if it is not in the
+///   table yet. May grow the table, which moves every chunk.
+TerrainChunk &
+chunk_table_get(ChunkTable *table, vec2 position, bool *new_chunk = 0);
+
+/// Remove a chunk, which may move other chunks in the table.
+void
+chunk_table_remove(ChunkTable *table, TerrainChunk *terrain_chunk);
+
+
+#endif
@@ -0,0 +1,47 @@
+#include "frustum.h"
+
+
+void
+get_frustum(const mat4x4 matrix, Frustum *frustum)
+{
+  // Clip space coordinate n is row n of the matrix dotted with the point, and
+  //   a point is inside when -w <= x, y, z <= w
+  vec4 rows[4];
+  for (int row_n = 0;
+       row_n < 4;
+       ++row_n)
+  {
+    rows[row_n] = {matrix[0][row_n], matrix[1][row_n], matrix[2][row_n], matrix[3][row_n]};
+  }
+
+  for (int axis_n = 0;
+       axis_n < 3;
+       ++axis_n)
+  {
+    frustum->planes[2*axis_n] = vec4Add(rows[3], rows[axis_n]);
+    frustum->planes[2*axis_n + 1] = vec4Subtract(rows[3], rows[axis_n]);
+  }
+}
+
+
+bool
+box_outside_frustum(const Frustum &frustum, vec3 min, vec3 max)
+{
+  for (int plane_n = 0;
+       plane_n < 6;
+       ++plane_n)
+  {
+    // The box's corner furthest along the plane's normal
+    const vec4 &plane = frustum.planes[plane_n];
+    vec3 corner = {plane.x >= 0 ? max.x : min.x,
+                   plane.y >= 0 ? max.y : min.y,
+                   plane.z >= 0 ? max.z : min.z};
+
+    if (plane.x*corner.x + plane.y*corner.y + plane.z*corner.z + plane.w < 0)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,25 @@
+#ifndef FRUSTUM_H_DEF
+#define FRUSTUM_H_DEF
+
+#include "ccVector.h"
+
+
+/// The six planes of a view frustum, as (a, b, c, d) with a point p inside
+///   when a*p.x + b*p.y + c*p.z + d >= 0 for every plane.
+struct Frustum
+{
+  vec4 planes[6];
+};
+
+
+/// The frustum of a projection matrix, in the space the matrix transforms from.
+void
+get_frustum(const mat4x4 matrix, Frustum *frustum);
+
+/// Whether the axis-aligned box from min to max lies wholly outside the
+///   frustum. Boxes across a corner of the frustum may not be found outside.
+bool
+box_outside_frustum(const Frustum &frustum, vec3 min, vec3 max);
+
+
+#endif
@@ -0,0 +1,361 @@
+#include "gpu-terrain.h"
+#include "lattice.h"
+#include "shader.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+
+/// The GL state gpu_terrain_submit() changes, so the frame's rendering is not
+///   disturbed by generating terrain part way through it.
+struct SavedGLState
+{
+  GLint draw_framebuffer;
+  GLint read_framebuffer;
+  GLint viewport[4];
+  GLint program;
+  GLint vertex_array;
+  GLint pixel_pack_buffer;
+  GLboolean depth_test;
+  GLboolean cull_face;
+  GLboolean blend;
+  GLboolean scissor_test;
+};
+
+
+SavedGLState
+save_gl_state()
+{
+  SavedGLState state;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &state.draw_framebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &state.read_framebuffer);
+  glGetIntegerv(GL_VIEWPORT, state.viewport);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &state.program);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &state.vertex_array);
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &state.pixel_pack_buffer);
+  state.depth_test = glIsEnabled(GL_DEPTH_TEST);
+  state.cull_face = glIsEnabled(GL_CULL_FACE);
+  state.blend = glIsEnabled(GL_BLEND);
+  state.scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+  return state;
+}
+
+
+void
+set_gl_enabled(GLenum capability, GLboolean enabled)
+{
+  if (enabled)
+  {
+    glEnable(capability);
+  }
+  else
+  {
+    glDisable(capability);
+  }
+}
+
+
+void
+restore_gl_state(const SavedGLState &state)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, state.draw_framebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, state.read_framebuffer);
+  glViewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+  glUseProgram(state.program);
+  glBindVertexArray(state.vertex_array);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, state.pixel_pack_buffer);
+  set_gl_enabled(GL_DEPTH_TEST, state.depth_test);
+  set_gl_enabled(GL_CULL_FACE, state.cull_face);
+  set_gl_enabled(GL_BLEND, state.blend);
+  set_gl_enabled(GL_SCISSOR_TEST, state.scissor_test);
+}
+
+
+GLuint
+create_tile_texture(GLint internal_format, GLenum format, int width, int height)
+{
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_FLOAT, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  return texture;
+}
+
+
+bool
+gpu_terrain_init(GpuTerrain *gpu_terrain, int tile_size)
+{
+  *gpu_terrain = {};
+  gpu_terrain->tile_size = tile_size;
+
+  gpu_terrain->program_id = LoadShaders("HeightmapVertexShader.vertexshader", "HeightmapFragmentShader.fragmentshader");
+  if (!gpu_terrain->program_id)
+  {
+    return false;
+  }
+
+  // LoadShaders() returns the program whether or not its shaders compiled
+  GLint linked;
+  glGetProgramiv(gpu_terrain->program_id, GL_LINK_STATUS, &linked);
+  if (!linked)
+  {
+    printf("GPU terrain shaders failed to link, generating terrain on the CPU\n");
+    glDeleteProgram(gpu_terrain->program_id);
+    gpu_terrain->program_id = 0;
+    return false;
+  }
+
+  gpu_terrain->tile_origin_uniform = glGetUniformLocation(gpu_terrain->program_id, "TILE_ORIGIN");
+  gpu_terrain->tile_row_uniform = glGetUniformLocation(gpu_terrain->program_id, "TILE_ROW");
+  gpu_terrain->n_octaves_uniform = glGetUniformLocation(gpu_terrain->program_id, "N_OCTAVES");
+  gpu_terrain->inv_periods_uniform = glGetUniformLocation(gpu_terrain->program_id, "INV_PERIODS");
+  gpu_terrain->amplitudes_uniform = glGetUniformLocation(gpu_terrain->program_id, "AMPLITUDES");
+  gpu_terrain->gradients_uniform = glGetUniformLocation(gpu_terrain->program_id, "GRADIENTS");
+
+  SavedGLState saved_state = save_gl_state();
+
+  // The gradients never change, so they are uploaded once
+  vec2 gradients[GRADIENT_TABLE_SIZE];
+  for (int gradient_n = 0;
+       gradient_n < GRADIENT_TABLE_SIZE;
+       ++gradient_n)
+  {
+    gradients[gradient_n] = {GRADIENT_TABLE.x[gradient_n], GRADIENT_TABLE.y[gradient_n]};
+  }
+  glUseProgram(gpu_terrain->program_id);
+  glUniform2fv(gpu_terrain->gradients_uniform, GRADIENT_TABLE_SIZE, (float *)gradients);
+
+  // Core profile draws need a vertex array, even one without attributes
+  glGenVertexArrays(1, &gpu_terrain->vertex_array);
+
+  int texture_height = tile_size * GPU_TERRAIN_BATCH_TILES;
+  gpu_terrain->height_texture = create_tile_texture(GL_R32F, GL_RED, tile_size, texture_height);
+  gpu_terrain->slope_texture = create_tile_texture(GL_RG32F, GL_RG, tile_size, texture_height);
+
+  glGenFramebuffers(1, &gpu_terrain->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, gpu_terrain->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpu_terrain->height_texture, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gpu_terrain->slope_texture, 0);
+
+  const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, draw_buffers);
+
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  if (!complete)
+  {
+    printf("GPU terrain framebuffer is incomplete, generating terrain on the CPU\n");
+  }
+
+  for (int batch_n = 0;
+       batch_n < GPU_TERRAIN_N_BATCHES;
+       ++batch_n)
+  {
+    GpuTerrainBatch &batch = gpu_terrain->batches[batch_n];
+
+    glGenBuffers(1, &batch.height_pixel_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, batch.height_pixel_buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, tile_size * texture_height * sizeof(float), 0, GL_STREAM_READ);
+
+    glGenBuffers(1, &batch.slope_pixel_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, batch.slope_pixel_buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, tile_size * texture_height * sizeof(vec2), 0, GL_STREAM_READ);
+  }
+
+  restore_gl_state(saved_state);
+
+  if (!complete)
+  {
+    gpu_terrain_free(gpu_terrain);
+  }
+
+  return complete;
+}
+
+
+void
+gpu_terrain_free(GpuTerrain *gpu_terrain)
+{
+  // Drain the ring so no readback is still writing into the buffers
+  GpuTerrainBatch *batch;
+  while ((batch = gpu_terrain_map_finished(gpu_terrain, true)))
+  {
+    gpu_terrain_release(gpu_terrain, batch);
+  }
+
+  for (int batch_n = 0;
+       batch_n < GPU_TERRAIN_N_BATCHES;
+       ++batch_n)
+  {
+    glDeleteBuffers(1, &gpu_terrain->batches[batch_n].height_pixel_buffer);
+    glDeleteBuffers(1, &gpu_terrain->batches[batch_n].slope_pixel_buffer);
+  }
+
+  glDeleteFramebuffers(1, &gpu_terrain->framebuffer);
+  glDeleteTextures(1, &gpu_terrain->height_texture);
+  glDeleteTextures(1, &gpu_terrain->slope_texture);
+  glDeleteVertexArrays(1, &gpu_terrain->vertex_array);
+  glDeleteProgram(gpu_terrain->program_id);
+
+  *gpu_terrain = {};
+}
+
+
+bool
+gpu_terrain_submit(GpuTerrain *gpu_terrain, int n_tiles, const vec2 *tile_origins, void *const *tile_tags,
+                   int n_octaves, const int *periods, const float *amplitudes)
+{
+  assert(n_tiles > 0 && n_tiles <= GPU_TERRAIN_BATCH_TILES);
+  assert(n_octaves <= 16);
+
+  if (gpu_terrain->n_in_flight == GPU_TERRAIN_N_BATCHES)
+  {
+    return false;
+  }
+
+  GpuTerrainBatch &batch = gpu_terrain->batches[gpu_terrain->next_submit_n];
+  int tile_size = gpu_terrain->tile_size;
+
+  SavedGLState saved_state = save_gl_state();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, gpu_terrain->framebuffer);
+  glUseProgram(gpu_terrain->program_id);
+  glBindVertexArray(gpu_terrain->vertex_array);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+  glDisable(GL_SCISSOR_TEST);
+
+  // Divided on the CPU to match perlin_octaves_tile() exactly
+  float inv_periods[16];
+  for (int octave_n = 0;
+       octave_n < n_octaves;
+       ++octave_n)
+  {
+    inv_periods[octave_n] = 1.0f/periods[octave_n];
+  }
+  glUniform1i(gpu_terrain->n_octaves_uniform, n_octaves);
+  glUniform1fv(gpu_terrain->inv_periods_uniform, n_octaves, inv_periods);
+  glUniform1fv(gpu_terrain->amplitudes_uniform, n_octaves, amplitudes);
+
+  for (int tile_n = 0;
+       tile_n < n_tiles;
+       ++tile_n)
+  {
+    int tile_row = tile_n * tile_size;
+    glViewport(0, tile_row, tile_size, tile_size);
+    glUniform2i(gpu_terrain->tile_origin_uniform, tile_origins[tile_n].x, tile_origins[tile_n].y);
+    glUniform1i(gpu_terrain->tile_row_uniform, tile_row);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    batch.tile_tags[tile_n] = tile_tags[tile_n];
+  }
+
+  // Tiles are stacked vertically, so each one's rows are contiguous in the readback
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, batch.height_pixel_buffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glReadPixels(0, 0, tile_size, tile_size * n_tiles, GL_RED, GL_FLOAT, 0);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, batch.slope_pixel_buffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT1);
+  glReadPixels(0, 0, tile_size, tile_size * n_tiles, GL_RG, GL_FLOAT, 0);
+
+  batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  batch.n_tiles = n_tiles;
+
+  restore_gl_state(saved_state);
+
+  gpu_terrain->next_submit_n = (gpu_terrain->next_submit_n + 1) % GPU_TERRAIN_N_BATCHES;
+  ++gpu_terrain->n_in_flight;
+  gpu_terrain->n_tiles_generated += n_tiles;
+
+  return true;
+}
+
+
+GpuTerrainBatch *
+gpu_terrain_map_finished(GpuTerrain *gpu_terrain, bool wait)
+{
+  if (gpu_terrain->n_in_flight == 0)
+  {
+    return 0;
+  }
+
+  GpuTerrainBatch *batch = &gpu_terrain->batches[gpu_terrain->next_read_n];
+  assert(batch->fence && !batch->heights);
+
+  GLuint64 timeout_ns = wait ? 1000000000 : 0;
+  GLenum status;
+  do
+  {
+    status = glClientWaitSync(batch->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+  }
+  while (wait && status == GL_TIMEOUT_EXPIRED);
+
+  if (status == GL_TIMEOUT_EXPIRED)
+  {
+    return 0;
+  }
+
+  glDeleteSync(batch->fence);
+  batch->fence = 0;
+
+  GLint pixel_pack_buffer;
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer);
+
+  int n_cells = batch->n_tiles * gpu_terrain->tile_size * gpu_terrain->tile_size;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, batch->height_pixel_buffer);
+  batch->heights = (const float *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, n_cells * sizeof(float), GL_MAP_READ_BIT);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, batch->slope_pixel_buffer);
+  batch->slopes = (const vec2 *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, n_cells * sizeof(vec2), GL_MAP_READ_BIT);
+
+  // Either both buffers are mapped or neither is
+  if (!batch->heights || !batch->slopes)
+  {
+    if (batch->heights)
+    {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, batch->height_pixel_buffer);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    if (batch->slopes)
+    {
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    batch->heights = 0;
+    batch->slopes = 0;
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+
+  return batch;
+}
+
+
+void
+gpu_terrain_release(GpuTerrain *gpu_terrain, GpuTerrainBatch *batch)
+{
+  assert(batch == &gpu_terrain->batches[gpu_terrain->next_read_n]);
+
+  if (batch->heights)
+  {
+    GLint pixel_pack_buffer;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, batch->height_pixel_buffer);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, batch->slope_pixel_buffer);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+  }
+
+  batch->heights = 0;
+  batch->slopes = 0;
+  batch->n_tiles = 0;
+
+  gpu_terrain->next_read_n = (gpu_terrain->next_read_n + 1) % GPU_TERRAIN_N_BATCHES;
+  --gpu_terrain->n_in_flight;
+}
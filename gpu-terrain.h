@@ -0,0 +1,93 @@
+#ifndef GPU_TERRAIN_H_DEF
+#define GPU_TERRAIN_H_DEF
+
+#include "ccVector.h"
+#include <GL/gl3w.h>
+#include <stdint.h>
+
+
+// GPU height map generation
+//
+// Tiles of Perlin octaves are rendered by HeightmapFragmentShader into a
+//   column of tile_size x tile_size squares of an R32F height texture, with
+//   the slopes in a second RG32F attachment. Each batch is read back into its
+//   own pixel buffer objects, and a fence tells when the copy has landed, so
+//   the CPU only touches the results a frame or more later. Works on any GL 3.3
+//   implementation, including Mesa's llvmpipe.
+
+const int GPU_TERRAIN_BATCH_TILES = 64;
+const int GPU_TERRAIN_N_BATCHES = 4;
+
+struct GpuTerrainBatch
+{
+  GLuint height_pixel_buffer;
+  GLuint slope_pixel_buffer;
+
+  // Non-zero until the batch's readback has been waited on
+  GLsync fence;
+
+  int n_tiles;
+  void *tile_tags[GPU_TERRAIN_BATCH_TILES];
+
+  // Tile n's height map starts at heights[n * tile_size*tile_size], valid
+  //   between gpu_terrain_map_finished() and gpu_terrain_release(). Both are 0
+  //   if the readback could not be mapped.
+  const float *heights;
+  const vec2 *slopes;
+};
+
+struct GpuTerrain
+{
+  GLuint program_id;
+  GLint tile_origin_uniform;
+  GLint tile_row_uniform;
+  GLint n_octaves_uniform;
+  GLint inv_periods_uniform;
+  GLint amplitudes_uniform;
+  GLint gradients_uniform;
+
+  GLuint vertex_array;
+  GLuint framebuffer;
+  GLuint height_texture;
+  GLuint slope_texture;
+
+  int tile_size;
+
+  // Batches are submitted and read back in ring order
+  GpuTerrainBatch batches[GPU_TERRAIN_N_BATCHES];
+  int next_submit_n;
+  int next_read_n;
+  int n_in_flight;
+
+  int n_tiles_generated;
+};
+
+
+/// Returns false, freeing everything again, if the shaders or framebuffer are
+///   unsupported, then the terrain has to be generated on the CPU.
+bool
+gpu_terrain_init(GpuTerrain *gpu_terrain, int tile_size);
+
+void
+gpu_terrain_free(GpuTerrain *gpu_terrain);
+
+/// Render n_tiles <= GPU_TERRAIN_BATCH_TILES tiles of the octaves, starting at
+///   tile_origins, and start reading them back. tile_tags are handed back with
+///   the results. Returns false, doing nothing, if every batch is in flight.
+bool
+gpu_terrain_submit(GpuTerrain *gpu_terrain, int n_tiles, const vec2 *tile_origins, void *const *tile_tags,
+                   int n_octaves, const int *periods, const float *amplitudes);
+
+/// Map the oldest batch in flight if its readback has finished, or after
+///   waiting for it if wait is set. Returns 0 if there is nothing to map. A
+///   batch whose buffers fail to map is still returned, with heights and
+///   slopes 0, to be released.
+GpuTerrainBatch *
+gpu_terrain_map_finished(GpuTerrain *gpu_terrain, bool wait);
+
+/// Unmap a batch from gpu_terrain_map_finished() so it can be submitted again.
+void
+gpu_terrain_release(GpuTerrain *gpu_terrain, GpuTerrainBatch *batch);
+
+
+#endif
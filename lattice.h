@@ -0,0 +1,58 @@
+#ifndef LATTICE_H_DEF
+#define LATTICE_H_DEF
+
+#include <stdint.h>
+
+
+// Gradient table
+//
+// Lattice corners pick one of GRADIENT_TABLE_SIZE evenly spaced unit vectors
+//   through lattice_hash(), so no trig is done once the table is built. Shared
+//   by every noise backend.
+
+const int GRADIENT_TABLE_SIZE = 256;
+
+struct GradientTable
+{
+  float x[GRADIENT_TABLE_SIZE];
+  float y[GRADIENT_TABLE_SIZE];
+};
+
+
+/// Defined once, in noise.cpp.
+extern const GradientTable GRADIENT_TABLE;
+
+
+const uint32_t LATTICE_HASH_X = 0x8da6b343;
+const uint32_t LATTICE_HASH_Y = 0xd8163841;
+const uint32_t LATTICE_HASH_MIX = 0x7feb352d;
+
+
+/// Finalise a combined lattice coordinate into a gradient table index.
+inline int
+lattice_hash_finalise(uint32_t hash)
+{
+  hash ^= hash >> 16;
+  hash *= LATTICE_HASH_MIX;
+  hash ^= hash >> 15;
+  return hash & (GRADIENT_TABLE_SIZE - 1);
+}
+
+
+inline int
+lattice_hash(int x, int y)
+{
+  return lattice_hash_finalise(((uint32_t)x * LATTICE_HASH_X) ^ ((uint32_t)y * LATTICE_HASH_Y));
+}
+
+
+/// floorf() without the library call, for values well inside int range.
+inline float
+floor_fast(float x)
+{
+  float truncated = (float)(int)x;
+  return truncated > x ? truncated - 1 : truncated;
+}
+
+
+#endif
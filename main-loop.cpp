@@ -3,12 +3,19 @@
 #include "imgui.h"
 #include "shader.h"
 #include "bitmap.h"
+#include "chunk-codec.h"
+#include "frustum.h"
 #include "perlin.h"
+#include "worker-pool.h"
 
 #include "ccVector.h"
 
 #include <GL/gl3w.h>
 #include <SDL.h>
+#include <algorithm>
+#include <limits.h>
+#include <mutex>
+#include <vector>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -20,6 +27,16 @@ const int VERTEX_UV_ATTRIBUTE = 2;
 const int VERTEX_NORMAL_ATTRIBUTE = 3;
 const int VERTEX_TANGENT_ATTRIBUTE = 4;
 const int VERTEX_BITANGENT_ATTRIBUTE = 5;
+const int INSTANCE_HEIGHT_ATTRIBUTE = 6;
+const int INSTANCE_SLOPE_ATTRIBUTE = 7;
+
+// About 16 MB of generated chunks, at the 800 or so bytes they compress to
+const int CHUNK_CACHE_CAPACITY = 16384;
+
+// Weight of each chunk's timing in GameState::chunk_generate_us and chunk_decode_us
+const float CHUNK_WORK_US_SMOOTHING = 0.05f;
+
+const char CHUNK_REGION_DIRECTORY[] = "chunk-regions";
 
 
 uint64_t
@@ -76,130 +93,1773 @@ opengl_print_error(GLenum error_code, const char *file, int line)
       error = "GL_INVALID_FRAMEBUFFER_OPERATION";
     } break;
   }
-  printf("OpenGL error: %s at %s:%d\n", error, file, line);
+  printf("OpenGL error: %s at %s:%d\n", error, file, line);
+}
+
+
+/// Get all errors from OpenGL, and print them.
+bool
+_opengl_print_errors(const char *file, int line)
+{
+  bool success = true;
+
+  GLenum error = glGetError();
+  while (error != GL_NO_ERROR)
+  {
+    success &= false;
+    opengl_print_error(error, file, line);
+
+    error = glGetError();
+  }
+
+  return success;
+}
+
+
+/// Index into the chunk's finest generated level of detail of the cube covering
+///   position, relative to the chunk's origin.
+int
+get_chunk_cell_index(TerrainChunk &terrain_chunk, vec2 position)
+{
+  int lod = terrain_chunk.lod;
+  return chunk_lod_offset(lod) + (int(position.y) >> lod) * chunk_lod_size(lod) + (int(position.x) >> lod);
+}
+
+
+float
+get_height_from_chunk(TerrainChunk &terrain_chunk, vec2 position)
+{
+  return get_chunk_height(terrain_chunk, get_chunk_cell_index(terrain_chunk, position));
+}
+
+
+bool
+terrain_parameters_equal(const TerrainParameters &a, const TerrainParameters &b)
+{
+  if (a.noise_backend != b.noise_backend ||
+      a.n_perlins != b.n_perlins)
+  {
+    return false;
+  }
+
+  for (int perlin_n = 0;
+       perlin_n < a.n_perlins;
+       ++perlin_n)
+  {
+    if (a.perlin_periods[perlin_n] != b.perlin_periods[perlin_n] ||
+        a.perlin_amplitudes[perlin_n] != b.perlin_amplitudes[perlin_n])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/// FNV-1a over the fields of the plan which affect the terrain, never 0.
+uint64_t
+hash_octave_plan(const OctavePlan &plan)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  auto mix = [&hash](const void *data, size_t size) {
+    for (size_t byte_n = 0;
+         byte_n < size;
+         ++byte_n)
+    {
+      hash = (hash ^ ((const uint8_t *)data)[byte_n]) * 0x100000001b3;
+    }
+  };
+
+  mix(&plan.noise_backend, sizeof(plan.noise_backend));
+  mix(&plan.n_octaves, sizeof(plan.n_octaves));
+  mix(plan.periods, plan.n_octaves * sizeof(plan.periods[0]));
+  mix(plan.amplitudes, plan.n_octaves * sizeof(plan.amplitudes[0]));
+
+  return hash ? hash : 1;
+}
+
+
+/// Compile the Perlin parameters into the fewest octaves with the same sum.
+///   Octaves of equal period sample the same lattice, so they merge into one
+///   octave with their summed amplitude, and octaves with no amplitude left
+///   are dropped. Octaves of different periods share no lattice points, so
+///   the rest are only ordered longest period first, running the octaves
+///   which take the same perlin_tile() path back to back.
+OctavePlan
+plan_octaves(const TerrainParameters &parameters)
+{
+  OctavePlan plan = {};
+  plan.noise_backend = parameters.noise_backend;
+
+  for (int perlin_n = 0;
+       perlin_n < parameters.n_perlins;
+       ++perlin_n)
+  {
+    int period = parameters.perlin_periods[perlin_n];
+
+    int octave_n = 0;
+    while (octave_n < plan.n_octaves && plan.periods[octave_n] != period)
+    {
+      ++octave_n;
+    }
+
+    if (octave_n == plan.n_octaves)
+    {
+      plan.periods[octave_n] = period;
+      plan.amplitudes[octave_n] = 0;
+      ++plan.n_octaves;
+    }
+    plan.amplitudes[octave_n] += parameters.perlin_amplitudes[perlin_n];
+  }
+
+  int n_kept = 0;
+  for (int octave_n = 0;
+       octave_n < plan.n_octaves;
+       ++octave_n)
+  {
+    if (plan.amplitudes[octave_n] == 0)
+    {
+      continue;
+    }
+
+    int period = plan.periods[octave_n];
+    float amplitude = plan.amplitudes[octave_n];
+
+    // Insert by descending period, n_kept <= octave_n so nothing unread is overwritten
+    int insert_n = n_kept;
+    while (insert_n > 0 && plan.periods[insert_n - 1] < period)
+    {
+      plan.periods[insert_n] = plan.periods[insert_n - 1];
+      plan.amplitudes[insert_n] = plan.amplitudes[insert_n - 1];
+      --insert_n;
+    }
+    plan.periods[insert_n] = period;
+    plan.amplitudes[insert_n] = amplitude;
+    ++n_kept;
+  }
+  plan.n_octaves = n_kept;
+  plan.hash = hash_octave_plan(plan);
+
+  return plan;
+}
+
+
+/// Fill a chunk's height map from an octave plan at level of detail lod, and
+///   the coarser levels from that. Below full resolution each cube is one
+///   sample at its centre, so a far chunk costs a fraction of a near one.
+void
+generate_chunk(const OctavePlan *plan, vec2 chunk_position, int lod, float *height_map, vec2 *slope_map)
+{
+  vec2 chunk_origin = vec2Multiply(chunk_position, (float)CHUNK_SIZE);
+  const NoiseFunctions &noise = get_noise_functions(plan->noise_backend);
+
+  if (lod == 0)
+  {
+    noise.octaves_tile(chunk_origin, CHUNK_SIZE, plan->n_octaves, plan->periods, plan->amplitudes, height_map, slope_map);
+  }
+  else
+  {
+    int size = chunk_lod_size(lod);
+    float cube_size = CHUNK_SIZE / size;
+    float *heights = height_map + chunk_lod_offset(lod);
+    vec2 *slopes = slope_map + chunk_lod_offset(lod);
+
+    // Full resolution cubes are centred on whole positions
+    vec2 first_centre = vec2Add(chunk_origin, {0.5f*(cube_size - 1), 0.5f*(cube_size - 1)});
+
+    for (int y = 0;
+         y < size;
+         ++y)
+    for (int x = 0;
+         x < size;
+         ++x)
+    {
+      vec2 position = vec2Add(first_centre, {x*cube_size, y*cube_size});
+
+      float height = 0;
+      vec2 slope = {};
+      for (int octave_n = 0;
+           octave_n < plan->n_octaves;
+           ++octave_n)
+      {
+        vec2 gradient;
+        height += plan->amplitudes[octave_n] * noise.sample_gradient(position, plan->periods[octave_n], &gradient);
+        slope = vec2Add(slope, vec2Multiply(gradient, plan->amplitudes[octave_n]));
+      }
+
+      heights[y*size + x] = height;
+      slopes[y*size + x] = slope;
+    }
+  }
+
+  build_chunk_lods(lod, height_map, slope_map);
+}
+
+
+/// Where the slopes start in a chunk's height buffer, aligned for any attribute type.
+const int SLOPE_BUFFER_OFFSET = (sizeof(TerrainChunk::height_map) + 3) & ~3;
+
+
+void
+upload_chunk_heights(TerrainChunk &terrain_chunk)
+{
+  if (!terrain_chunk.height_buffer)
+  {
+    glGenBuffers(1, &terrain_chunk.height_buffer);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, terrain_chunk.height_buffer);
+  glBufferData(GL_ARRAY_BUFFER, SLOPE_BUFFER_OFFSET + sizeof(terrain_chunk.slope_map), 0, GL_DYNAMIC_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(terrain_chunk.height_map), terrain_chunk.height_map);
+  glBufferSubData(GL_ARRAY_BUFFER, SLOPE_BUFFER_OFFSET, sizeof(terrain_chunk.slope_map), terrain_chunk.slope_map);
+  terrain_chunk.height_buffer_dirty = false;
+  terrain_chunk.dirty_cells_start = 0;
+  terrain_chunk.dirty_cells_end = 0;
+}
+
+
+/// Upload cells [start, end) of the chunk's maps into its height buffer.
+void
+upload_chunk_cells(TerrainChunk &terrain_chunk, int start, int end)
+{
+  glBufferSubData(GL_ARRAY_BUFFER, start * sizeof(ChunkHeight), (end - start) * sizeof(ChunkHeight),
+                  terrain_chunk.height_map + start);
+  glBufferSubData(GL_ARRAY_BUFFER, SLOPE_BUFFER_OFFSET + start * sizeof(ChunkSlope), (end - start) * sizeof(ChunkSlope),
+                  terrain_chunk.slope_map + start);
+}
+
+
+/// Upload the cells terrain edits changed since the chunk's buffer was
+///   uploaded, rather than the whole buffer, returning how many.
+int
+upload_chunk_dirty_cells(TerrainChunk &terrain_chunk)
+{
+  int coarser_start = chunk_lod_offset(terrain_chunk.lod + 1);
+
+  glBindBuffer(GL_ARRAY_BUFFER, terrain_chunk.height_buffer);
+  upload_chunk_cells(terrain_chunk, terrain_chunk.dirty_cells_start, terrain_chunk.dirty_cells_end);
+  upload_chunk_cells(terrain_chunk, coarser_start, CHUNK_LOD_CELLS);
+
+  int n_cells = terrain_chunk.dirty_cells_end - terrain_chunk.dirty_cells_start + CHUNK_LOD_CELLS - coarser_start;
+  terrain_chunk.dirty_cells_start = 0;
+  terrain_chunk.dirty_cells_end = 0;
+  return n_cells;
+}
+
+
+// Chunk streaming
+//
+// Chunks are generated by the worker pool, or by the GPU through
+//   stream_gpu_chunks(), into their own ChunkRequest, never into the hashmap.
+//   Chunks held in the region files are loaded by the workers the same way.
+//   The main thread copies finished requests into their slots in
+//   integrate_streamed_chunks(), within a per-frame time budget, and drops any
+//   whose chunk was evicted or invalidated meanwhile.
+
+struct ChunkRequest
+{
+  ChunkStreamer *streamer;
+
+  vec2 position;
+  int terrain_gen_id;
+  OctavePlan plan;
+  int lod;
+
+  float height_map[CHUNK_LOD_CELLS];
+  vec2 slope_map[CHUNK_LOD_CELLS];
+
+  // With load set, the maps are read from the region files in
+  //   region_directory, and with decode set decompressed from data, a chunk
+  //   cache entry. Otherwise they are generated, and with encode set
+  //   compressed into data for the main thread to cache.
+  bool load;
+  const char *region_directory;
+  bool decode;
+  bool encode;
+  uint8_t data[CHUNK_CODEC_MAX_BYTES];
+  int data_size;
+  float codec_height_error;
+  float codec_slope_error;
+
+  // Time a worker took to generate or decode the maps, if timed is set
+  bool timed;
+  uint64_t work_us;
+};
+
+struct ChunkStreamer
+{
+  std::mutex mutex;
+  std::vector<ChunkRequest *> completed;
+
+  // Main thread only
+  std::vector<ChunkRequest *> integrating;
+  std::vector<ChunkRequest *> gpu_queued;
+  int n_in_flight;
+
+  uint64_t second_start_time;
+  int n_completed_this_second;
+  int completed_per_second;
+};
+
+
+void
+fill_chunk_request(ChunkRequest *request)
+{
+  // Loads are not timed, and fall back to generating the chunk should its
+  //   region file have changed since the chunk was found there
+  if (request->load)
+  {
+    int loaded_lod = chunk_region_read(request->region_directory, request->plan.hash, request->position, request->lod,
+                                       request->height_map, request->slope_map);
+    if (loaded_lod >= 0)
+    {
+      request->lod = loaded_lod;
+      return;
+    }
+    request->load = false;
+  }
+
+  uint64_t start_time = get_us();
+  if (request->decode)
+  {
+    decode_chunk_maps(request->data, request->data_size, request->height_map, request->slope_map);
+  }
+  else
+  {
+    generate_chunk(&request->plan, request->position, request->lod, request->height_map, request->slope_map);
+  }
+  request->work_us = get_us() - start_time;
+  request->timed = true;
+
+  if (request->encode)
+  {
+    request->data_size = encode_chunk_maps(request->lod, request->height_map, request->slope_map, request->data,
+                                           &request->codec_height_error, &request->codec_slope_error);
+  }
+}
+
+
+void
+fill_chunk_request_work(void *data, int request_n)
+{
+  fill_chunk_request(((ChunkRequest **)data)[request_n]);
+}
+
+
+void
+stream_chunk_request_job(void *data, int)
+{
+  ChunkRequest *request = (ChunkRequest *)data;
+  fill_chunk_request(request);
+
+  std::lock_guard<std::mutex> lock(request->streamer->mutex);
+  request->streamer->completed.push_back(request);
+}
+
+
+TerrainChunk *
+find_chunk(GameState *game_state, vec2 position)
+{
+  if (game_state->chunk_store == ChunkStore::Clipmap)
+  {
+    return chunk_clipmap_find(&game_state->chunk_clipmap, position);
+  }
+  else
+  {
+    return chunk_table_find(&game_state->chunk_table, position);
+  }
+}
+
+
+/// The terrain_gen_id of chunks in the active chunk store.
+int
+get_terrain_gen_id(GameState *game_state)
+{
+  if (game_state->chunk_store == ChunkStore::Clipmap)
+  {
+    return game_state->chunk_clipmap.terrain_gen_id;
+  }
+  else
+  {
+    return game_state->chunk_table.terrain_gen_id;
+  }
+}
+
+
+void
+get_terrain_bounds(GameState *game_state, vec2 *min, vec2 *max)
+{
+  if (game_state->chunk_store == ChunkStore::Clipmap)
+  {
+    ChunkClipmap &clipmap = game_state->chunk_clipmap;
+    *min = clipmap.origin;
+    *max = vec2Add(clipmap.origin, {(float)clipmap.size, (float)clipmap.size});
+  }
+  else
+  {
+    *min = {-floorf(game_state->current_terrain_dim.x*0.5f), -floorf(game_state->current_terrain_dim.y*0.5f)};
+    *max = { floorf(game_state->current_terrain_dim.x*0.5f),  floorf(game_state->current_terrain_dim.y*0.5f)};
+  }
+}
+
+
+ChunkRequest *
+new_chunk_request(GameState *game_state, vec2 position, int lod)
+{
+  ChunkRequest *request = new ChunkRequest;
+  request->streamer = game_state->chunk_streamer;
+  request->position = position;
+  request->terrain_gen_id = get_terrain_gen_id(game_state);
+  request->plan = game_state->octave_plan;
+  request->lod = lod;
+  request->load = false;
+  request->region_directory = 0;
+  request->decode = false;
+  request->encode = game_state->use_chunk_cache;
+  request->data_size = 0;
+  request->codec_height_error = 0;
+  request->codec_slope_error = 0;
+  request->timed = false;
+  return request;
+}
+
+
+/// Whether decoding a cached chunk has been measured cheaper than generating
+///   one from the current octave plan, which it is assumed to be until both
+///   have been measured.
+bool
+decode_is_cheaper(GameState *game_state)
+{
+  return game_state->chunk_decode_us == 0 ||
+         game_state->chunk_generate_us == 0 ||
+         game_state->chunk_decode_us <= game_state->chunk_generate_us;
+}
+
+
+/// store_chunk_maps() with the terrain edits reaching the chunk at position
+///   added to its generated maps.
+void
+store_edited_chunk_maps(GameState *game_state, TerrainChunk *terrain_chunk, vec2 position, int lod,
+                        const float *height_map, const vec2 *slope_map)
+{
+  ChunkMaps edited_maps;
+  if (get_chunk_edit_maps(&game_state->terrain_edits, position, edited_maps.height_map, edited_maps.slope_map))
+  {
+    for (int cell_n = chunk_lod_offset(lod);
+         cell_n < CHUNK_LOD_CELLS;
+         ++cell_n)
+    {
+      edited_maps.height_map[cell_n] += height_map[cell_n];
+      edited_maps.slope_map[cell_n] = vec2Add(edited_maps.slope_map[cell_n], slope_map[cell_n]);
+    }
+    height_map = edited_maps.height_map;
+    slope_map = edited_maps.slope_map;
+  }
+
+  store_chunk_maps(terrain_chunk, lod, height_map, slope_map,
+                   &game_state->max_height_quantisation_error, &game_state->max_slope_quantisation_error);
+}
+
+
+#ifdef CHUNK_HALO
+/// Fill the halo of the chunk at position from its neighbours, and copy its
+///   edges into theirs, once it is stored.
+void
+update_chunk_halos(GameState *game_state, TerrainChunk *terrain_chunk, vec2 position)
+{
+  for (int neighbour_y = -1;
+       neighbour_y <= 1;
+       ++neighbour_y)
+  for (int neighbour_x = -1;
+       neighbour_x <= 1;
+       ++neighbour_x)
+  {
+    if (neighbour_x == 0 && neighbour_y == 0)
+    {
+      continue;
+    }
+
+    TerrainChunk *neighbour = find_chunk(game_state, vec2Add(position, {(float)neighbour_x, (float)neighbour_y}));
+    fill_chunk_halo(terrain_chunk, neighbour, neighbour_x, neighbour_y);
+    if (neighbour && neighbour->ready)
+    {
+      fill_chunk_halo(neighbour, terrain_chunk, -neighbour_x, -neighbour_y);
+    }
+  }
+}
+#endif
+
+
+/// Start filling the chunk at position at level lod or finer. Returns a request
+///   to decode the chunk from the chunk cache if it is held there and decoding
+///   is cheaper, else to load it from the region files if they hold it, else to
+///   generate it.
+ChunkRequest *
+request_chunk(GameState *game_state, TerrainChunk *terrain_chunk, vec2 position, int lod)
+{
+  uint64_t parameter_hash = game_state->octave_plan.hash;
+  int cached_lod;
+
+  if (game_state->use_chunk_cache &&
+      decode_is_cheaper(game_state))
+  {
+    const ChunkCacheEntry *entry = chunk_cache_find(&game_state->chunk_cache, parameter_hash, position, lod, &cached_lod);
+    if (entry)
+    {
+      ChunkRequest *request = new_chunk_request(game_state, position, cached_lod);
+      request->decode = true;
+      request->encode = false;
+      memcpy(request->data, entry->data, entry->size);
+      request->data_size = entry->size;
+
+      terrain_chunk->requested_lod = cached_lod;
+      return request;
+    }
+  }
+
+  // Loaded chunks are not cached, the region files are cheaper to load from
+  if (game_state->use_chunk_region_store)
+  {
+    // Only the slot's header entry is read here, its maps are left for a worker
+    if (chunk_region_store_find(&game_state->chunk_region_store, parameter_hash, position, lod, &cached_lod))
+    {
+      ChunkRequest *request = new_chunk_request(game_state, position, cached_lod);
+      request->load = true;
+      request->region_directory = game_state->chunk_region_store.directory;
+      request->encode = false;
+
+      terrain_chunk->requested_lod = cached_lod;
+      return request;
+    }
+  }
+
+  terrain_chunk->requested_lod = lod;
+  return new_chunk_request(game_state, position, lod);
+}
+
+
+void
+integrate_chunk_request(GameState *game_state, ChunkRequest *request)
+{
+  // Timings are clamped, so a worker preempted mid-chunk cannot stop decoding
+  //   for good, which is the only way chunk_decode_us is measured again
+  if (request->timed)
+  {
+    float &work_us = request->decode ? game_state->chunk_decode_us : game_state->chunk_generate_us;
+    work_us = work_us ? work_us + (std::min((float)request->work_us, 2 * work_us) - work_us) * CHUNK_WORK_US_SMOOTHING : request->work_us;
+  }
+
+  TerrainChunk *terrain_chunk = find_chunk(game_state, request->position);
+  if (terrain_chunk &&
+      request->terrain_gen_id == get_terrain_gen_id(game_state) &&
+      (!terrain_chunk->ready || request->lod < terrain_chunk->lod))
+  {
+    // Decoded and loaded chunks were stored when generated
+    bool generated = !request->decode && !request->load;
+    if (generated &&
+        game_state->use_chunk_cache)
+    {
+      // Chunks from the GPU are not encoded yet
+      if (!request->data_size)
+      {
+        request->data_size = encode_chunk_maps(request->lod, request->height_map, request->slope_map, request->data,
+                                               &request->codec_height_error, &request->codec_slope_error);
+      }
+      chunk_cache_put(&game_state->chunk_cache, request->plan.hash, request->position, request->lod, request->data, request->data_size);
+
+      game_state->max_codec_height_error = fmaxf(game_state->max_codec_height_error, request->codec_height_error);
+      game_state->max_codec_slope_error = fmaxf(game_state->max_codec_slope_error, request->codec_slope_error);
+    }
+    if (generated &&
+        game_state->use_chunk_region_store)
+    {
+      chunk_region_store_put(&game_state->chunk_region_store, request->plan.hash, request->position, request->lod, request->height_map, request->slope_map);
+    }
+
+    store_edited_chunk_maps(game_state, terrain_chunk, request->position, request->lod, request->height_map, request->slope_map);
+    terrain_chunk->lod = request->lod;
+    terrain_chunk->ready = true;
+    upload_chunk_heights(*terrain_chunk);
+#ifdef CHUNK_HALO
+    update_chunk_halos(game_state, terrain_chunk, request->position);
+#endif
+  }
+
+  delete request;
+}
+
+
+/// Integrate finished chunks until the frame's streaming budget is spent.
+void
+integrate_streamed_chunks(GameState *game_state)
+{
+  ChunkStreamer *streamer = game_state->chunk_streamer;
+
+  {
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+    streamer->integrating.insert(streamer->integrating.end(), streamer->completed.begin(), streamer->completed.end());
+    streamer->completed.clear();
+  }
+
+  uint64_t integrate_start_time = get_us();
+  uint64_t budget_us = game_state->stream_budget_ms * 1000;
+
+  int n_integrated = 0;
+  while (n_integrated < streamer->integrating.size() &&
+         get_us() - integrate_start_time <= budget_us)
+  {
+    integrate_chunk_request(game_state, streamer->integrating[n_integrated]);
+    ++n_integrated;
+  }
+
+  streamer->integrating.erase(streamer->integrating.begin(), streamer->integrating.begin() + n_integrated);
+  streamer->n_in_flight -= n_integrated;
+
+  streamer->n_completed_this_second += n_integrated;
+  if (integrate_start_time - streamer->second_start_time >= 1000000)
+  {
+    streamer->completed_per_second = streamer->n_completed_this_second;
+    streamer->n_completed_this_second = 0;
+    streamer->second_start_time = integrate_start_time;
+  }
+}
+
+
+/// Keep the GPU's batches filled from gpu_queued, and pass each batch read back
+///   on to integrate_streamed_chunks() like a worker's. With wait, returns only
+///   once every queued chunk has been read back.
+void
+stream_gpu_chunks(GameState *game_state, bool wait)
+{
+  GpuTerrain *gpu_terrain = &game_state->gpu_terrain;
+  ChunkStreamer *streamer = game_state->chunk_streamer;
+  std::vector<ChunkRequest *> &queued = streamer->gpu_queued;
+
+  while (true)
+  {
+    int n_submitted = 0;
+    while (n_submitted < queued.size())
+    {
+      // Requests for an old terrain are dropped by integrate_chunk_request() anyway
+      ChunkRequest *first = queued[n_submitted];
+      if (first->terrain_gen_id != get_terrain_gen_id(game_state))
+      {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        streamer->completed.push_back(first);
+        ++n_submitted;
+        continue;
+      }
+
+      // A batch shares one octave plan, which only changes with the terrain_gen_id
+      vec2 tile_origins[GPU_TERRAIN_BATCH_TILES];
+      void *tile_tags[GPU_TERRAIN_BATCH_TILES];
+      int n_tiles = 0;
+      while (n_tiles < GPU_TERRAIN_BATCH_TILES &&
+             n_submitted + n_tiles < queued.size() &&
+             queued[n_submitted + n_tiles]->terrain_gen_id == first->terrain_gen_id)
+      {
+        ChunkRequest *request = queued[n_submitted + n_tiles];
+        tile_origins[n_tiles] = vec2Multiply(request->position, (float)CHUNK_SIZE);
+        tile_tags[n_tiles] = request;
+        ++n_tiles;
+      }
+
+      if (!gpu_terrain_submit(gpu_terrain, n_tiles, tile_origins, tile_tags,
+                              first->plan.n_octaves, first->plan.periods, first->plan.amplitudes))
+      {
+        break;
+      }
+      n_submitted += n_tiles;
+    }
+    queued.erase(queued.begin(), queued.begin() + n_submitted);
+
+    GpuTerrainBatch *batch = gpu_terrain_map_finished(gpu_terrain, wait);
+    if (!batch)
+    {
+      break;
+    }
+
+    // Chunks whose readback was lost are generated by the workers instead
+    if (!batch->heights)
+    {
+      for (int tile_n = 0;
+           tile_n < batch->n_tiles;
+           ++tile_n)
+      {
+        worker_pool_push_job(game_state->worker_pool, stream_chunk_request_job, batch->tile_tags[tile_n], 0);
+      }
+      gpu_terrain_release(gpu_terrain, batch);
+      continue;
+    }
+
+    // The GPU always generates full resolution, even for chunks requested coarser
+    const int tile_cells = CHUNK_SIZE*CHUNK_SIZE;
+    for (int tile_n = 0;
+         tile_n < batch->n_tiles;
+         ++tile_n)
+    {
+      ChunkRequest *request = (ChunkRequest *)batch->tile_tags[tile_n];
+      memcpy(request->height_map, batch->heights + tile_n*tile_cells, tile_cells * sizeof(float));
+      memcpy(request->slope_map, batch->slopes + tile_n*tile_cells, tile_cells * sizeof(vec2));
+      build_chunk_lods(0, request->height_map, request->slope_map);
+      request->lod = 0;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(streamer->mutex);
+      streamer->completed.insert(streamer->completed.end(), (ChunkRequest **)batch->tile_tags, (ChunkRequest **)batch->tile_tags + batch->n_tiles);
+    }
+
+    gpu_terrain_release(gpu_terrain, batch);
+  }
+}
+
+
+vec2
+get_chunk_position(vec2 position)
+{
+  vec2 chunk_position = vec2Multiply(position, 1.0/CHUNK_SIZE);
+  chunk_position = {floorf(chunk_position.x), floorf(chunk_position.y)};
+  return chunk_position;
+}
+
+
+/// Throw away every chunk, they are regenerated from the current parameters.
+void
+invalidate_terrain(GameState *game_state)
+{
+  chunk_table_clear(&game_state->chunk_table);
+  chunk_clipmap_clear(&game_state->chunk_clipmap);
+  game_state->generated_terrain_parameters = game_state->terrain_parameters;
+  game_state->octave_plan = plan_octaves(game_state->generated_terrain_parameters);
+}
+
+
+/// Bytes resident per chunk, in the chunk table and on the GPU.
+const int CHUNK_RESIDENT_BYTES = sizeof(ChunkKey) + sizeof(TerrainChunk) + SLOPE_BUFFER_OFFSET + sizeof(TerrainChunk::slope_map);
+
+
+float
+chunk_distance_squared(vec2 chunk_position, vec2 camera_chunk_position)
+{
+  vec2 offset = vec2Subtract(chunk_position, camera_chunk_position);
+  return vec2DotProduct(offset, offset);
+}
+
+
+// Chunk levels of detail
+//
+// Level l > 0 is drawn from lod_distance * 2^(l-1) chunks away. A chunk's drawn
+//   level only changes once the camera is lod_hysteresis further past that
+//   distance, so chunks on a boundary do not flicker between levels. Chunks
+//   are generated at the coarsest level they could be drawn at, and generated
+//   again finer as the camera approaches.
+
+/// Distance in chunks from the camera to the centre of the chunk at chunk_position.
+float
+get_chunk_lod_distance(GameState *game_state, vec2 chunk_position)
+{
+  vec2 camera = vec2Multiply({game_state->camera_position.x, game_state->camera_position.z}, 1.0f/CHUNK_SIZE);
+  vec2 centre = vec2Add(chunk_position, {0.5f, 0.5f});
+  return vec2Length(vec2Subtract(centre, camera));
+}
+
+
+/// Distance in chunks from which level lod is drawn.
+float
+get_lod_start_distance(GameState *game_state, int lod)
+{
+  return game_state->lod_distance * (1 << lod) * 0.5f;
+}
+
+
+/// The coarsest level a chunk at distance may have to be drawn at before it
+///   is next checked.
+int
+get_generate_lod(GameState *game_state, float distance)
+{
+  int lod = 0;
+  while (game_state->chunk_lod &&
+         lod + 1 < CHUNK_N_LODS &&
+         distance >= get_lod_start_distance(game_state, lod + 1) * (1 - game_state->lod_hysteresis))
+  {
+    ++lod;
+  }
+  return lod;
+}
+
+
+/// Move the chunk's drawn level towards the level for distance, with
+///   hysteresis, and return the level to draw, no finer than what has been
+///   generated.
+int
+update_render_lod(GameState *game_state, TerrainChunk *terrain_chunk, float distance)
+{
+  int lod = 0;
+  if (game_state->chunk_lod)
+  {
+    float hysteresis = game_state->lod_hysteresis;
+    lod = terrain_chunk->render_lod;
+    while (lod + 1 < CHUNK_N_LODS &&
+           distance > get_lod_start_distance(game_state, lod + 1) * (1 + hysteresis))
+    {
+      ++lod;
+    }
+    while (lod > 0 &&
+           distance < get_lod_start_distance(game_state, lod) * (1 - hysteresis))
+    {
+      --lod;
+    }
+  }
+  terrain_chunk->render_lod = lod;
+
+  return std::max(lod, terrain_chunk->lod);
+}
+
+
+/// Generate whichever chunks within the terrain bounds do not exist yet,
+///   nearest to the camera first. The whole terrain is only regenerated if the
+///   Perlin parameters changed or the terrain shrank. When streaming, the chunks
+///   are only queued here and show up as integrate_streamed_chunks() receives
+///   them. Chunks already generated coarser than their distance now needs are
+///   generated again, before any new chunks.
+///
+/// With the chunk table, the terrain covers user_terrain_dim. Once
+///   chunk_memory_budget_mb is used up, chunks furthest from the camera are
+///   evicted to make room for nearer ones. Evicted chunks come back when the
+///   camera moves towards them and generate_terrain() runs again.
+///
+/// With the clipmap, the terrain is the clipmap's window centred on the camera,
+///   so only the row or column of chunks entering the window is generated as
+///   the camera crosses a chunk boundary.
+void
+generate_terrain(GameState *game_state)
+{
+  uint64_t generate_start_time = get_us();
+
+  ChunkTable *table = &game_state->chunk_table;
+  ChunkClipmap *clipmap = &game_state->chunk_clipmap;
+  ChunkStreamer *streamer = game_state->chunk_streamer;
+  bool use_clipmap = game_state->chunk_store == ChunkStore::Clipmap;
+
+  if (use_clipmap && clipmap->size_log2 != game_state->user_clipmap_size_log2)
+  {
+    chunk_clipmap_free(clipmap);
+    chunk_clipmap_init(clipmap, game_state->user_clipmap_size_log2);
+  }
+
+  // Parameters which plan to the same octaves generate the same terrain
+  if (!terrain_parameters_equal(game_state->terrain_parameters, game_state->generated_terrain_parameters) &&
+      plan_octaves(game_state->terrain_parameters).hash == game_state->octave_plan.hash)
+  {
+    game_state->generated_terrain_parameters = game_state->terrain_parameters;
+  }
+
+  if (!terrain_parameters_equal(game_state->terrain_parameters, game_state->generated_terrain_parameters) ||
+      (!use_clipmap && (game_state->user_terrain_dim.x < game_state->current_terrain_dim.x ||
+                        game_state->user_terrain_dim.y < game_state->current_terrain_dim.y)))
+  {
+    invalidate_terrain(game_state);
+  }
+
+  vec2 camera_chunk_position = get_chunk_position({game_state->camera_position.x, game_state->camera_position.z});
+
+  if (use_clipmap)
+  {
+    float half_size = clipmap->size / 2;
+    chunk_clipmap_move(clipmap, vec2Subtract(camera_chunk_position, {half_size, half_size}));
+    game_state->current_terrain_dim = {(float)clipmap->size, (float)clipmap->size};
+  }
+  else
+  {
+    game_state->current_terrain_dim = game_state->user_terrain_dim;
+  }
+
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+
+  auto nearer = [camera_chunk_position](vec2 a, vec2 b) {
+    return chunk_distance_squared(a, camera_chunk_position) < chunk_distance_squared(b, camera_chunk_position);
+  };
+
+  std::vector<vec2> missing_chunks;
+  std::vector<ChunkRequest *> requests;
+
+  vec2 chunk_position;
+  for (chunk_position.y = terrain_min.y;
+       chunk_position.y < terrain_max.y;
+       ++chunk_position.y)
+  for (chunk_position.x = terrain_min.x;
+       chunk_position.x < terrain_max.x;
+       ++chunk_position.x)
+  {
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (!terrain_chunk)
+    {
+      missing_chunks.push_back(chunk_position);
+      continue;
+    }
+
+    // Refining needs no new slot, so it happens whatever the memory budget
+    int lod = get_generate_lod(game_state, get_chunk_lod_distance(game_state, chunk_position));
+    if (lod < terrain_chunk->requested_lod)
+    {
+      requests.push_back(request_chunk(game_state, terrain_chunk, chunk_position, lod));
+    }
+  }
+
+  std::sort(missing_chunks.begin(), missing_chunks.end(), nearer);
+
+  // The clipmap's window always fits, so it never evicts
+  int max_chunks = game_state->chunk_memory_budget_mb * 1024 * 1024 / CHUNK_RESIDENT_BYTES;
+  if (use_clipmap)
+  {
+    max_chunks = INT_MAX;
+  }
+
+  // Furthest first, only gathered when something will have to be evicted
+  std::vector<vec2> eviction_candidates;
+  if (table->n_chunks + missing_chunks.size() > max_chunks)
+  {
+    for (int slot_n = 0;
+         slot_n < table->capacity;
+         ++slot_n)
+    {
+      if (table->keys[slot_n].terrain_gen_id == table->terrain_gen_id)
+      {
+        eviction_candidates.push_back(table->keys[slot_n].position);
+      }
+    }
+    std::sort(eviction_candidates.begin(), eviction_candidates.end(), [nearer](vec2 a, vec2 b) { return nearer(b, a); });
+  }
+
+  int n_evicted = 0;
+
+  for (vec2 missing_chunk_position : missing_chunks)
+  {
+    // Make room by evicting chunks further from the camera than this one
+    while (table->n_chunks >= max_chunks &&
+           n_evicted < eviction_candidates.size() &&
+           nearer(missing_chunk_position, eviction_candidates[n_evicted]))
+    {
+      chunk_table_remove(table, chunk_table_find(table, eviction_candidates[n_evicted]));
+      ++n_evicted;
+    }
+
+    if (table->n_chunks >= max_chunks)
+    {
+      // Everything resident is nearer than the rest of the missing chunks
+      break;
+    }
+
+    int lod = get_generate_lod(game_state, get_chunk_lod_distance(game_state, missing_chunk_position));
+
+    TerrainChunk *terrain_chunk;
+    if (use_clipmap)
+    {
+      terrain_chunk = &chunk_clipmap_get(clipmap, missing_chunk_position);
+    }
+    else
+    {
+      terrain_chunk = &chunk_table_get(table, missing_chunk_position);
+    }
+    terrain_chunk->render_lod = lod;
+
+    requests.push_back(request_chunk(game_state, terrain_chunk, missing_chunk_position, lod));
+  }
+
+  // Shed the furthest chunks if the budget was lowered
+  while (table->n_chunks > max_chunks &&
+         n_evicted < eviction_candidates.size())
+  {
+    chunk_table_remove(table, chunk_table_find(table, eviction_candidates[n_evicted]));
+    ++n_evicted;
+  }
+
+  game_state->n_evicted_chunks += n_evicted;
+
+  streamer->n_in_flight += requests.size();
+
+  int n_decoded = std::count_if(requests.begin(), requests.end(), [](ChunkRequest *request) { return request->decode; });
+  int n_loaded = std::count_if(requests.begin(), requests.end(), [](ChunkRequest *request) { return request->load; });
+  game_state->last_terrain_gen_n_chunks = requests.size() - n_decoded - n_loaded;
+  game_state->last_terrain_gen_n_decoded = n_decoded;
+
+  // The GPU pass only implements Perlin noise, and decoding and loading stay on
+  //   the workers
+  bool use_gpu = game_state->generate_on_gpu &&
+                 game_state->gpu_terrain_available &&
+                 game_state->octave_plan.noise_backend == NoiseBackend::Perlin;
+
+  if (use_gpu)
+  {
+    auto first_generated = std::stable_partition(requests.begin(), requests.end(), [](ChunkRequest *request) { return request->decode || request->load; });
+    streamer->gpu_queued.insert(streamer->gpu_queued.end(), first_generated, requests.end());
+    requests.erase(first_generated, requests.end());
+  }
+
+  if (game_state->stream_terrain)
+  {
+    for (ChunkRequest *request : requests)
+    {
+      worker_pool_push_job(game_state->worker_pool, stream_chunk_request_job, request, 0);
+    }
+  }
+  else
+  {
+    parallel_for(game_state->worker_pool, requests.size(), fill_chunk_request_work, requests.data());
+
+    {
+      std::lock_guard<std::mutex> lock(streamer->mutex);
+      streamer->completed.insert(streamer->completed.end(), requests.begin(), requests.end());
+    }
+  }
+
+  if (use_gpu)
+  {
+    stream_gpu_chunks(game_state, !game_state->stream_terrain);
+  }
+
+  game_state->last_terrain_gen_us = get_us() - generate_start_time;
+}
+
+
+/// The terrain's gradient (dh/dx, dh/dz) at position, zero where there is no
+///   ready chunk.
+vec2
+get_terrain_slope_for_global_position(GameState *game_state, vec2 position)
+{
+  vec2 chunk_position = get_chunk_position(position);
+  vec2 chunk_offset = vec2Subtract(position, vec2Multiply(chunk_position, CHUNK_SIZE));
+
+  TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+  if (!terrain_chunk || !terrain_chunk->ready)
+  {
+    return {};
+  }
+
+  return get_chunk_slope(*terrain_chunk, get_chunk_cell_index(*terrain_chunk, chunk_offset));
+}
+
+
+float
+get_terrain_height_for_global_position(GameState *game_state, vec2 position)
+{
+  vec2 chunk_position = get_chunk_position(position);
+  vec2 chunk_offset = vec2Subtract(position, vec2Multiply(chunk_position, CHUNK_SIZE));
+
+  TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+  if (!terrain_chunk || !terrain_chunk->ready)
+  {
+    return 0;
+  }
+
+  return get_height_from_chunk(*terrain_chunk, chunk_offset);
+}
+
+
+/// Height and, unless slope is 0, slope of the full resolution cube x, y of the
+///   chunk, or of the cube covering it if the chunk is coarser, and zero if it
+///   is not ready.
+void
+sample_chunk(TerrainChunk *terrain_chunk, int x, int y, float *height, vec2 *slope)
+{
+  if (!terrain_chunk || !terrain_chunk->ready)
+  {
+    *height = 0;
+    if (slope)
+    {
+      *slope = {};
+    }
+    return;
+  }
+
+  int cell_n = get_chunk_cell_index(*terrain_chunk, {(float)x, (float)y});
+  *height = get_chunk_height(*terrain_chunk, cell_n);
+  if (slope)
+  {
+    *slope = get_chunk_slope(*terrain_chunk, cell_n);
+  }
+}
+
+
+#ifdef CHUNK_HALO
+/// sample_chunk() reaching one cube past the chunk's edges, into its halo.
+void
+sample_chunk_with_halo(TerrainChunk *terrain_chunk, int x, int y, float *height, vec2 *slope)
+{
+  if ((x < CHUNK_SIZE && y < CHUNK_SIZE) || !terrain_chunk || !terrain_chunk->ready)
+  {
+    sample_chunk(terrain_chunk, x, y, height, slope);
+    return;
+  }
+
+  int halo_n = chunk_halo_index(x, y);
+  *height = terrain_chunk->halo_heights[halo_n];
+  if (slope)
+  {
+    *slope = terrain_chunk->halo_slopes[halo_n];
+  }
+}
+#endif
+
+
+struct HeightQuery
+{
+  uint64_t chunk_key;
+  int position_n;
+};
+
+
+void
+get_terrain_heights(GameState *game_state, int n_positions, const vec2 *positions, bool bilinear, float *heights, vec3 *normals)
+{
+  if (n_positions == 0)
+  {
+    return;
+  }
+
+  // Bilinear samples run between cube centres, from the one at or before the
+  //   position to the next
+  vec2 sample_offset = bilinear ? vec2{0.5, 0.5} : vec2{0, 0};
+
+  std::vector<int> chunk_xs(n_positions);
+  std::vector<int> chunk_ys(n_positions);
+  int min_x = INT_MAX, min_y = INT_MAX;
+  int max_x = INT_MIN, max_y = INT_MIN;
+  for (int position_n = 0;
+       position_n < n_positions;
+       ++position_n)
+  {
+    vec2 chunk_position = get_chunk_position(vec2Subtract(positions[position_n], sample_offset));
+    chunk_xs[position_n] = (int)chunk_position.x;
+    chunk_ys[position_n] = (int)chunk_position.y;
+    min_x = std::min(min_x, chunk_xs[position_n]);
+    min_y = std::min(min_y, chunk_ys[position_n]);
+    max_x = std::max(max_x, chunk_xs[position_n]);
+    max_y = std::max(max_y, chunk_ys[position_n]);
+  }
+
+  // Grouped by chunk, so each chunk and its +x and +y neighbours are looked up
+  //   once for all its positions. Positions spread densely enough over the
+  //   chunks they cover are binned by a counting sort, others sorted by chunk.
+  std::vector<HeightQuery> queries(n_positions);
+  int64_t n_bins_x = (int64_t)max_x - min_x + 1;
+  int64_t n_bins = n_bins_x * ((int64_t)max_y - min_y + 1);
+  if (n_bins <= 4 * (int64_t)n_positions)
+  {
+    std::vector<int> bin_starts(n_bins + 1);
+    for (int position_n = 0;
+         position_n < n_positions;
+         ++position_n)
+    {
+      ++bin_starts[(chunk_ys[position_n] - min_y) * n_bins_x + (chunk_xs[position_n] - min_x) + 1];
+    }
+    for (int bin_n = 0;
+         bin_n < n_bins;
+         ++bin_n)
+    {
+      bin_starts[bin_n + 1] += bin_starts[bin_n];
+    }
+    for (int position_n = 0;
+         position_n < n_positions;
+         ++position_n)
+    {
+      uint64_t bin_n = (chunk_ys[position_n] - min_y) * n_bins_x + (chunk_xs[position_n] - min_x);
+      queries[bin_starts[bin_n]++] = {bin_n, position_n};
+    }
+  }
+  else
+  {
+    for (int position_n = 0;
+         position_n < n_positions;
+         ++position_n)
+    {
+      uint64_t key_y = (uint32_t)(chunk_ys[position_n] - min_y);
+      uint64_t key_x = (uint32_t)(chunk_xs[position_n] - min_x);
+      queries[position_n] = {key_y << 32 | key_x, position_n};
+    }
+    std::sort(queries.begin(), queries.end(), [](const HeightQuery &a, const HeightQuery &b) {
+      return a.chunk_key < b.chunk_key;
+    });
+  }
+
+  // Each position's corners, gathered in position order, so the interpolation
+  //   after is over plain arrays and vectorises. Nearest samples only use the
+  //   first corner, which is the height itself, and slopes are only gathered
+  //   for normals.
+  int n_corners = bilinear ? 4 : 1;
+  std::vector<float> corner_heights(bilinear ? n_corners * n_positions : 0);
+  std::vector<vec2> corner_slopes(normals ? n_corners * n_positions : 0);
+  std::vector<vec2> fractions(bilinear ? n_positions : 0);
+  float *first_corner_heights = bilinear ? corner_heights.data() : heights;
+
+  int query_n = 0;
+  while (query_n < n_positions)
+  {
+    uint64_t chunk_key = queries[query_n].chunk_key;
+    int first_position_n = queries[query_n].position_n;
+    vec2 chunk_position = {(float)chunk_xs[first_position_n], (float)chunk_ys[first_position_n]};
+    vec2 chunk_origin = vec2Add(vec2Multiply(chunk_position, CHUNK_SIZE), sample_offset);
+
+    TerrainChunk *chunks[2][2] = {};
+    chunks[0][0] = find_chunk(game_state, chunk_position);
+#ifndef CHUNK_HALO
+    if (bilinear)
+    {
+      chunks[0][1] = find_chunk(game_state, vec2Add(chunk_position, {1, 0}));
+      chunks[1][0] = find_chunk(game_state, vec2Add(chunk_position, {0, 1}));
+      chunks[1][1] = find_chunk(game_state, vec2Add(chunk_position, {1, 1}));
+    }
+#endif
+
+    for (;
+         query_n < n_positions && queries[query_n].chunk_key == chunk_key;
+         ++query_n)
+    {
+      int position_n = queries[query_n].position_n;
+      vec2 offset = vec2Subtract(positions[position_n], chunk_origin);
+      int x = std::min((int)offset.x, CHUNK_SIZE - 1);
+      int y = std::min((int)offset.y, CHUNK_SIZE - 1);
+      if (bilinear)
+      {
+        fractions[position_n] = {offset.x - x, offset.y - y};
+      }
+
+      for (int corner_n = 0;
+           corner_n < n_corners;
+           ++corner_n)
+      {
+        int corner_x = x + (corner_n & 1);
+        int corner_y = y + (corner_n >> 1);
+        int corner_position_n = corner_n*n_positions + position_n;
+        vec2 *corner_slope = normals ? &corner_slopes[corner_position_n] : 0;
+#ifdef CHUNK_HALO
+        // Corners past the chunk's edges are in its halo
+        sample_chunk_with_halo(chunks[0][0], corner_x, corner_y, &first_corner_heights[corner_position_n], corner_slope);
+#else
+        int chunk_x = corner_x >= CHUNK_SIZE;
+        int chunk_y = corner_y >= CHUNK_SIZE;
+        sample_chunk(chunks[chunk_y][chunk_x], corner_x - chunk_x*CHUNK_SIZE, corner_y - chunk_y*CHUNK_SIZE,
+                     &first_corner_heights[corner_position_n], corner_slope);
+#endif
+      }
+    }
+  }
+
+  if (bilinear)
+  {
+    const float *heights_00 = corner_heights.data();
+    const float *heights_10 = heights_00 + n_positions;
+    const float *heights_01 = heights_10 + n_positions;
+    const float *heights_11 = heights_01 + n_positions;
+    for (int position_n = 0;
+         position_n < n_positions;
+         ++position_n)
+    {
+      vec2 fraction = fractions[position_n];
+      float height_0 = heights_00[position_n] + (heights_10[position_n] - heights_00[position_n]) * fraction.x;
+      float height_1 = heights_01[position_n] + (heights_11[position_n] - heights_01[position_n]) * fraction.x;
+      heights[position_n] = height_0 + (height_1 - height_0) * fraction.y;
+    }
+  }
+
+  if (normals)
+  {
+    const vec2 *slopes_00 = corner_slopes.data();
+    const vec2 *slopes_10 = slopes_00 + (bilinear ? n_positions : 0);
+    const vec2 *slopes_01 = slopes_10 + (bilinear ? n_positions : 0);
+    const vec2 *slopes_11 = slopes_01 + (bilinear ? n_positions : 0);
+    for (int position_n = 0;
+         position_n < n_positions;
+         ++position_n)
+    {
+      // With nearest samples every corner is the first
+      vec2 fraction = bilinear ? fractions[position_n] : vec2{0, 0};
+      vec2 slope_0 = vec2Add(slopes_00[position_n], vec2Multiply(vec2Subtract(slopes_10[position_n], slopes_00[position_n]), fraction.x));
+      vec2 slope_1 = vec2Add(slopes_01[position_n], vec2Multiply(vec2Subtract(slopes_11[position_n], slopes_01[position_n]), fraction.x));
+      vec2 slope = vec2Add(slope_0, vec2Multiply(vec2Subtract(slope_1, slope_0), fraction.y));
+
+      // As the vertex shader's smooth shading
+      float inverse_length = 1 / sqrtf(slope.x*slope.x + 1 + slope.y*slope.y);
+      normals[position_n] = {-slope.x * inverse_length, inverse_length, -slope.y * inverse_length};
+    }
+  }
+}
+
+
+const char *CUBE_FACE_NAMES[] = {"inside", "-x", "+x", "bottom", "top", "-z", "+z"};
+
+
+float
+get_cube_bounce(GameState *game_state, vec2 translation)
+{
+  float sine_offset;
+  if (game_state->sine_offset_type == SineOffsetType::Diagonal)
+  {
+    sine_offset = (translation.x/game_state->current_terrain_dim.x + translation.y/game_state->current_terrain_dim.y) * game_state->oscillation_frequency*2*M_PI;
+  }
+  else
+  {
+    sine_offset = vec2Length(translation) / (0.5f * vec2Length(game_state->current_terrain_dim)) * game_state->oscillation_frequency*2*M_PI;
+  }
+
+  return sinf(game_state->bounce_phase + sine_offset) * game_state->bounce_height;
+}
+
+
+// Ray casting
+//
+// Rays are walked in a grid space shifted half a cube from the terrain's, in
+//   which full resolution cube x covers [x, x + 1) and chunk x covers
+//   [x*CHUNK_SIZE, (x + 1)*CHUNK_SIZE). Each column of the grid holds a single
+//   cube, so the walk only steps across X and Z, and where the ray is in Y is
+//   found from the distance along it. Chunks are stepped through with a 2D DDA,
+//   and within a chunk the min/max height pyramid is descended front to back,
+//   each block the ray passes wholly above or below being skipped with the
+//   cubes under it.
+
+struct TerrainRay
+{
+  GameState *game_state;
+
+  // In grid space
+  vec3 origin;
+  vec3 direction;
+
+  // 1/direction, kept finite for axes the ray is parallel to, whose sign is
+  //   the direction stepped along them
+  vec3 inverse_direction;
+
+  TerrainRayHit *hit;
+};
+
+
+/// The face of a cube entered by stepping along axis_n, 0 for X and 2 for Z, in
+///   the ray's direction.
+CubeFace
+get_entry_face(const TerrainRay &ray, int axis_n)
+{
+  if (axis_n == 0)
+  {
+    return ray.inverse_direction.x > 0 ? CubeFace::NegativeX : CubeFace::PositiveX;
+  }
+  else
+  {
+    return ray.inverse_direction.z > 0 ? CubeFace::NegativeZ : CubeFace::PositiveZ;
+  }
+}
+
+
+/// Whether the ray between t_enter and t_exit passes through the heights
+///   bottom to top, setting t_hit to where it first does, and face to the face
+///   it enters by.
+bool
+ray_crosses_heights(const TerrainRay &ray, float t_enter, float t_exit, float bottom, float top, float *t_hit, CubeFace *face)
+{
+  float t_bottom = (bottom - ray.origin.y) * ray.inverse_direction.y;
+  float t_top = (top - ray.origin.y) * ray.inverse_direction.y;
+  float t_slab_enter = fminf(t_bottom, t_top);
+  float t_slab_exit = fmaxf(t_bottom, t_top);
+
+  if (t_slab_enter > t_exit || t_slab_exit < t_enter)
+  {
+    return false;
+  }
+
+  if (t_slab_enter > t_enter)
+  {
+    *t_hit = t_slab_enter;
+    *face = ray.inverse_direction.y < 0 ? CubeFace::Top : CubeFace::Bottom;
+  }
+  else
+  {
+    *t_hit = t_enter;
+  }
+  return true;
 }
 
 
-/// Get all errors from OpenGL, and print them.
+/// Cast the ray through cell x, y of the chunk's level, between t_enter and
+///   t_exit where it is over the cell, entering by face. Cells above lod are
+///   blocks of the min/max height pyramid, and cells of level lod are cubes.
 bool
-_opengl_print_errors(const char *file, int line)
+cast_ray_through_cell(const TerrainRay &ray, TerrainChunk *terrain_chunk, vec2 chunk_origin, int lod,
+                      int level, int x, int y, float t_enter, float t_exit, CubeFace face)
 {
-  bool success = true;
+  float cube_size = 1 << lod;
+  float bounce_height = fabsf(ray.game_state->bounce_height);
 
-  GLenum error = glGetError();
-  while (error != GL_NO_ERROR)
+  if (level == lod)
   {
-    success &= false;
-    opengl_print_error(error, file, line);
+    ++ray.hit->n_cubes_tested;
+
+    // Cubes reach half a cube above their heights and are as deep as they are
+    //   wide, see TransformVertexShader
+    vec2 translation = {x*cube_size + 0.5f*(cube_size - 1), y*cube_size + 0.5f*(cube_size - 1)};
+    int cell_n = chunk_lod_offset(lod) + y*chunk_lod_size(lod) + x;
+    float top = get_chunk_height(*terrain_chunk, cell_n) + 0.5f;
+    if (bounce_height != 0)
+    {
+      top += get_cube_bounce(ray.game_state, translation);
+    }
 
-    error = glGetError();
+    float t_hit;
+    if (!ray_crosses_heights(ray, t_enter, t_exit, top - cube_size, top, &t_hit, &face))
+    {
+      return false;
+    }
+
+    ray.hit->chunk_position = vec2Multiply(chunk_origin, 1.0f/CHUNK_SIZE);
+    ray.hit->lod = lod;
+    ray.hit->x = x;
+    ray.hit->y = y;
+    ray.hit->cube_position = vec2Add(chunk_origin, translation);
+    ray.hit->face = face;
+    ray.hit->distance = t_hit;
+    return true;
   }
 
-  return success;
-}
+  int bounds_n = chunk_bounds_offset(level) + y*chunk_lod_size(level) + x;
+  float bottom = terrain_chunk->min_heights[bounds_n] + 0.5f - cube_size - bounce_height;
+  float top = terrain_chunk->max_heights[bounds_n] + 0.5f + bounce_height;
+  float t_block_hit;
+  CubeFace block_face;
+  if (!ray_crosses_heights(ray, t_enter, t_exit, bottom, top, &t_block_hit, &block_face))
+  {
+    return false;
+  }
 
+  // Where the ray crosses between the cell's children, which it visits in
+  //   order
+  float child_size = 1 << (level - 1);
+  vec2 middle = vec2Add(chunk_origin, {(2*x + 1) * child_size, (2*y + 1) * child_size});
+  float t_middles[2] = {(middle.x - ray.origin.x) * ray.inverse_direction.x,
+                        (middle.y - ray.origin.z) * ray.inverse_direction.z};
+  bool positive[2] = {ray.inverse_direction.x > 0, ray.inverse_direction.z > 0};
+
+  // The child the ray starts in is on the far side of each middle it has
+  //   already crossed
+  int sides[2];
+  for (int axis_n = 0;
+       axis_n < 2;
+       ++axis_n)
+  {
+    bool crossed = t_middles[axis_n] <= t_enter;
+    sides[axis_n] = positive[axis_n] == crossed;
+    if (crossed)
+    {
+      t_middles[axis_n] = t_exit;
+    }
+  }
 
-TerrainChunk *
-get_terrain_chunk_slot(GameState *game_state, vec2 position)
-{
-  int hash = 0;
-  hash = ((hash<<5)^(hash>>29))^(int)position.x;
-  hash = ((hash<<7)^(hash>>31))^(int)position.y;
-  hash = (hash % 3203) % ARRAY_COUNT(game_state->terrain_chunk_hashmap);
-  return game_state->terrain_chunk_hashmap + hash;
+  float t_child_enter = t_enter;
+  while (true)
+  {
+    int axis_n = t_middles[0] < t_middles[1] ? 0 : 1;
+    float t_child_exit = fminf(t_middles[axis_n], t_exit);
+
+    if (cast_ray_through_cell(ray, terrain_chunk, chunk_origin, lod, level - 1,
+                              2*x + sides[0], 2*y + sides[1], t_child_enter, t_child_exit, face))
+    {
+      return true;
+    }
+
+    if (t_child_exit >= t_exit)
+    {
+      return false;
+    }
+
+    sides[axis_n] = !sides[axis_n];
+    face = get_entry_face(ray, 2*axis_n);
+    t_child_enter = t_middles[axis_n];
+    t_middles[axis_n] = t_exit;
+  }
 }
 
 
-TerrainChunk &
-get_terrain_chunk(GameState *game_state, vec2 position)
+bool
+cast_terrain_ray(GameState *game_state, vec3 origin, vec3 direction, float max_distance, TerrainRayHit *hit)
 {
-  TerrainChunk *initial_slot = get_terrain_chunk_slot(game_state, position);
-  TerrainChunk *slot = initial_slot;
-  while (slot->terrain_gen_id == game_state->terrain_gen_id && !vec2Equal(slot->position, position))
+  *hit = {};
+
+  TerrainRay ray;
+  ray.game_state = game_state;
+  ray.origin = vec3Add(origin, {0.5, 0, 0.5});
+  ray.direction = vec3Normalize(direction);
+  ray.hit = hit;
+  for (int axis_n = 0;
+       axis_n < 3;
+       ++axis_n)
   {
-    slot++;
-    if (slot == game_state->terrain_chunk_hashmap + ARRAY_COUNT(game_state->terrain_chunk_hashmap))
+    float component = ray.direction.v[axis_n];
+    if (fabsf(component) < 1e-20f)
     {
-      slot = game_state->terrain_chunk_hashmap;
+      component = 1e-20f;
     }
-    assert(slot != initial_slot);
+    ray.inverse_direction.v[axis_n] = 1 / component;
   }
 
-  if (slot->terrain_gen_id != game_state->terrain_gen_id)
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+  vec2 grid_min = vec2Multiply(terrain_min, CHUNK_SIZE);
+  vec2 grid_max = vec2Multiply(terrain_max, CHUNK_SIZE);
+
+  // Clip the ray to the terrain
+  float t_enter = 0;
+  float t_exit = max_distance;
+  CubeFace face = CubeFace::Inside;
+  for (int axis_n = 0;
+       axis_n < 3;
+       axis_n += 2)
+  {
+    float t_min = (grid_min.v[axis_n/2] - ray.origin.v[axis_n]) * ray.inverse_direction.v[axis_n];
+    float t_max = (grid_max.v[axis_n/2] - ray.origin.v[axis_n]) * ray.inverse_direction.v[axis_n];
+    if (fminf(t_min, t_max) > t_enter)
+    {
+      t_enter = fminf(t_min, t_max);
+      face = get_entry_face(ray, axis_n);
+    }
+    t_exit = fminf(t_exit, fmaxf(t_min, t_max));
+  }
+  if (t_enter >= t_exit)
   {
-    slot->position = position;
-    slot->terrain_gen_id = game_state->terrain_gen_id;
+    return false;
   }
-  else
+
+  // Step through the chunks the ray crosses, from the one it enters the
+  //   terrain by
+  vec3 entry = vec3Add(ray.origin, vec3Multiply(ray.direction, t_enter));
+  int chunk[2];
+  int steps[2];
+  float t_next[2];
+  float t_deltas[2];
+  for (int axis_n = 0;
+       axis_n < 2;
+       ++axis_n)
+  {
+    float grid_position = entry.v[2*axis_n];
+    chunk[axis_n] = (int)floorf(grid_position / CHUNK_SIZE);
+    chunk[axis_n] = std::max(chunk[axis_n], (int)terrain_min.v[axis_n]);
+    chunk[axis_n] = std::min(chunk[axis_n], (int)terrain_max.v[axis_n] - 1);
+
+    steps[axis_n] = ray.inverse_direction.v[2*axis_n] > 0 ? 1 : -1;
+    float boundary = (chunk[axis_n] + (steps[axis_n] > 0)) * CHUNK_SIZE;
+    t_next[axis_n] = (boundary - ray.origin.v[2*axis_n]) * ray.inverse_direction.v[2*axis_n];
+    t_deltas[axis_n] = CHUNK_SIZE * fabsf(ray.inverse_direction.v[2*axis_n]);
+  }
+
+  while (t_enter < t_exit)
   {
-    assert(vec2Equal(slot->position, position));
+    int axis_n = t_next[0] < t_next[1] ? 0 : 1;
+    float t_chunk_exit = fminf(t_next[axis_n], t_exit);
+
+    ++hit->n_chunks_stepped;
+    vec2 chunk_position = {(float)chunk[0], (float)chunk[1]};
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (terrain_chunk && terrain_chunk->ready)
+    {
+      // The level drawn, or the finest generated if the chunk has not been drawn
+      int lod = std::max(terrain_chunk->render_lod, terrain_chunk->lod);
+      vec2 chunk_origin = vec2Multiply(chunk_position, CHUNK_SIZE);
+      if (cast_ray_through_cell(ray, terrain_chunk, chunk_origin, lod, CHUNK_N_LODS - 1, 0, 0, t_enter, t_chunk_exit, face))
+      {
+        hit->position = vec3Add(origin, vec3Multiply(ray.direction, hit->distance));
+        return true;
+      }
+    }
+
+    chunk[axis_n] += steps[axis_n];
+    face = get_entry_face(ray, 2*axis_n);
+    t_enter = t_next[axis_n];
+    t_next[axis_n] += t_deltas[axis_n];
   }
 
-  return *slot;
+  return false;
 }
 
 
-float &
-get_height_from_chunk(TerrainChunk &terrain_chunk, vec2 position)
+/// The chunk holding the full resolution cube at global position x, y, and the
+///   cube's position within it.
+void
+get_cube_chunk(int x, int y, vec2 *chunk_position, int *chunk_x, int *chunk_y)
+{
+  *chunk_position = get_chunk_position({(float)x, (float)y});
+  *chunk_x = x - (int)chunk_position->x * CHUNK_SIZE;
+  *chunk_y = y - (int)chunk_position->y * CHUNK_SIZE;
+}
+
+
+float
+get_terrain_delta(GameState *game_state, int x, int y)
 {
-  return terrain_chunk.height_map[int(position.y) * CHUNK_SIZE + int(position.x)];
+  vec2 chunk_position;
+  int chunk_x, chunk_y;
+  get_cube_chunk(x, y, &chunk_position, &chunk_x, &chunk_y);
+
+  const ChunkEdits *chunk_edits = terrain_edits_find(&game_state->terrain_edits, chunk_position);
+  return chunk_edits ? chunk_edits->height_deltas[chunk_y*CHUNK_SIZE + chunk_x] : 0;
 }
 
 
+/// The maps the chunk at position is filled with at level lod before its edits
+///   are added: its region file slot if that holds the level, else generated
+///   again.
 void
-generate_terrain(GameState *game_state)
+get_chunk_source_maps(GameState *game_state, vec2 position, int lod, ChunkMaps *maps)
+{
+  if (game_state->use_chunk_region_store)
+  {
+    // The coarser levels of a finer chunk are averaged rather than generated
+    int stored_lod;
+    const ChunkMaps *stored_maps = chunk_region_store_find(&game_state->chunk_region_store, game_state->octave_plan.hash,
+                                                           position, lod, &stored_lod);
+    if (stored_maps && stored_lod == lod)
+    {
+      int first_cell_n = chunk_lod_offset(lod);
+      memcpy(maps->height_map + first_cell_n, stored_maps->height_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(float));
+      memcpy(maps->slope_map + first_cell_n, stored_maps->slope_map + first_cell_n, (CHUNK_LOD_CELLS - first_cell_n) * sizeof(vec2));
+      return;
+    }
+  }
+
+  generate_chunk(&game_state->octave_plan, position, lod, maps->height_map, maps->slope_map);
+}
+
+
+void
+set_terrain_deltas(GameState *game_state, int min_x, int min_y, int max_x, int max_y, const float *deltas)
 {
-  game_state->terrain_gen_id++;
-  game_state->current_terrain_dim = game_state->user_terrain_dim;
+  uint64_t start_time = get_us();
+
+  int width = max_x - min_x + 1;
+  for (int y = min_y;
+       y <= max_y;
+       ++y)
+  for (int x = min_x;
+       x <= max_x;
+       ++x)
+  {
+    vec2 chunk_position;
+    int chunk_x, chunk_y;
+    get_cube_chunk(x, y, &chunk_position, &chunk_x, &chunk_y);
+    ChunkEdits *chunk_edits = terrain_edits_get(&game_state->terrain_edits, chunk_position);
+    chunk_edits->height_deltas[chunk_y*CHUNK_SIZE + chunk_x] = deltas[(y - min_y)*width + x - min_x];
+  }
 
+  // Resident chunks are filled again from their source maps with their edit
+  //   maps, which reach a cube past the cubes changed by their slopes. Adding
+  //   just the change to the maps they hold would build up their quantisation
+  //   error with every edit.
+  vec2 first_chunk, last_chunk;
+  int chunk_x, chunk_y;
+  get_cube_chunk(min_x - 1, min_y - 1, &first_chunk, &chunk_x, &chunk_y);
+  get_cube_chunk(max_x + 1, max_y + 1, &last_chunk, &chunk_x, &chunk_y);
+
+  int n_rebuilt = 0;
   vec2 chunk_position;
-  for (chunk_position.x = -floorf(game_state->current_terrain_dim.x*0.5);
-       chunk_position.x < floorf(game_state->current_terrain_dim.x*0.5);
-       ++chunk_position.x)
-  for (chunk_position.y = -floorf(game_state->current_terrain_dim.y*0.5);
-       chunk_position.y < floorf(game_state->current_terrain_dim.y*0.5);
+  for (chunk_position.y = first_chunk.y;
+       chunk_position.y <= last_chunk.y;
        ++chunk_position.y)
+  for (chunk_position.x = first_chunk.x;
+       chunk_position.x <= last_chunk.x;
+       ++chunk_position.x)
   {
-    TerrainChunk &terrain_chunk = get_terrain_chunk(game_state, chunk_position);
-
-    vec2 translation;
-    for (translation.x = 0;
-         translation.x < CHUNK_SIZE;
-         ++translation.x)
-    for (translation.y = 0;
-         translation.y < CHUNK_SIZE;
-         ++translation.y)
-    {
-      vec2 global_position = vec2Add(vec2Multiply(chunk_position, (float)CHUNK_SIZE), translation);
-      float terrain_offset = 0;
-      for (int perlin_n = 0;
-           perlin_n < game_state->n_perlins;
-           ++perlin_n)
-      {
-        terrain_offset += game_state->perlin_amplitudes[perlin_n] * perlin(global_position, game_state->perlin_periods[perlin_n]);
-      }
-      get_height_from_chunk(terrain_chunk, translation) = terrain_offset;
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (!terrain_chunk || !terrain_chunk->ready)
+    {
+      continue;
+    }
+
+    int lod = terrain_chunk->lod;
+    ChunkMaps source_maps;
+    get_chunk_source_maps(game_state, chunk_position, lod, &source_maps);
+    store_edited_chunk_maps(game_state, terrain_chunk, chunk_position, lod, source_maps.height_map, source_maps.slope_map);
+#ifdef CHUNK_HALO
+    update_chunk_halos(game_state, terrain_chunk, chunk_position);
+#endif
+    ++n_rebuilt;
+
+#ifdef QUANTISE_HEIGHTS
+    // Storing scales the chunk anew, changing every cell
+    terrain_chunk->height_buffer_dirty = true;
+#else
+    // The rows of the chunk's finest level the change reaches
+    vec2 chunk_origin = vec2Multiply(chunk_position, CHUNK_SIZE);
+    int first_x = std::max(min_x - 1 - (int)chunk_origin.x, 0) >> lod;
+    int first_y = std::max(min_y - 1 - (int)chunk_origin.y, 0) >> lod;
+    int last_x = std::min(max_x + 1 - (int)chunk_origin.x, CHUNK_SIZE - 1) >> lod;
+    int last_y = std::min(max_y + 1 - (int)chunk_origin.y, CHUNK_SIZE - 1) >> lod;
+    int start = chunk_lod_offset(lod) + first_y*chunk_lod_size(lod) + first_x;
+    int end = chunk_lod_offset(lod) + last_y*chunk_lod_size(lod) + last_x + 1;
+    if (terrain_chunk->dirty_cells_end > terrain_chunk->dirty_cells_start)
+    {
+      start = std::min(start, terrain_chunk->dirty_cells_start);
+      end = std::max(end, terrain_chunk->dirty_cells_end);
     }
+    terrain_chunk->dirty_cells_start = start;
+    terrain_chunk->dirty_cells_end = end;
+#endif
   }
+
+  game_state->last_edit_us = get_us() - start_time;
+  game_state->last_edit_n_chunks = n_rebuilt;
 }
 
 
-vec2
-get_chunk_position(vec2 position)
+void
+apply_terrain_brush(GameState *game_state, vec2 centre, float target_height)
 {
-  vec2 chunk_position = vec2Multiply(position, 1.0/CHUNK_SIZE);
-  chunk_position = {floorf(chunk_position.x), floorf(chunk_position.y)};
-  return chunk_position;
-}
+  float radius = game_state->brush_radius;
+  int min_x = (int)ceilf(centre.x - radius);
+  int min_y = (int)ceilf(centre.y - radius);
+  int max_x = (int)floorf(centre.x + radius);
+  int max_y = (int)floorf(centre.y + radius);
+  if (min_x > max_x || min_y > max_y)
+  {
+    return;
+  }
 
+  int width = max_x - min_x + 1;
+  std::vector<float> deltas(width * (max_y - min_y + 1));
+  for (int y = min_y;
+       y <= max_y;
+       ++y)
+  for (int x = min_x;
+       x <= max_x;
+       ++x)
+  {
+    float delta = get_terrain_delta(game_state, x, y);
 
-float
-get_terrain_height_for_global_position(GameState *game_state, vec2 position)
-{
-  vec2 chunk_position = get_chunk_position(position);
-  vec2 chunk_offset = vec2Subtract(position, vec2Multiply(chunk_position, CHUNK_SIZE));
+    // Falling smoothly to 0 at the radius
+    vec2 offset = vec2Subtract({(float)x, (float)y}, centre);
+    float falloff = std::max(1 - vec2DotProduct(offset, offset) / (radius*radius), 0.0f);
+    float step = game_state->brush_strength * falloff*falloff;
+
+    switch (game_state->brush_mode)
+    {
+      case BrushMode::Raise:
+      {
+        delta += step;
+      } break;
+
+      case BrushMode::Lower:
+      {
+        delta -= step;
+      } break;
+
+      case BrushMode::Flatten:
+      {
+        float height = get_terrain_height_for_global_position(game_state, {(float)x, (float)y});
+        delta += std::min(std::max(target_height - height, -step), step);
+      } break;
+    }
+
+    deltas[(y - min_y)*width + x - min_x] = delta;
+  }
 
-  return get_height_from_chunk(get_terrain_chunk(game_state, chunk_position), chunk_offset);
+  set_terrain_deltas(game_state, min_x, min_y, max_x, max_y, deltas.data());
 }
 
 
@@ -250,6 +1910,10 @@ render_window(GameState *game_state, float surface_height)
     ImGui::DragInt("FPS", &game_state->fps, 1, 1, 120);
     ImGui::Value("Last Frame Delta", game_state->last_frame_delta);
     ImGui::Value("Last FPS", 1000000.0f/game_state->last_frame_total);
+    ImGui::Value("Draw calls", game_state->n_draw_calls);
+    ImGui::Value("Cubes drawn", game_state->n_cubes_drawn);
+    ToggleButton("Frustum culling", &game_state->frustum_culling);
+    ImGui::Value("Chunks culled", game_state->n_culled_chunks);
 
     ImGui::DragFloat("FOV", &game_state->fov, 1, 1, 180);
     ImGui::DragFloat3("Camera position", (float *)&game_state->camera_position.v);
@@ -261,6 +1925,39 @@ render_window(GameState *game_state, float surface_height)
     }
     ImGui::Text("Camera Velocity: %f  %f  %f", game_state->camera_velocity.x, game_state->camera_velocity.y, game_state->camera_velocity.z);
 
+    const TerrainRayHit &cursor_hit = game_state->cursor_hit;
+    if (game_state->cursor_ray_hit)
+    {
+      ImGui::Text("Cursor cube: %.1f %.1f, face %s, distance %.2f", cursor_hit.cube_position.x, cursor_hit.cube_position.y,
+                  CUBE_FACE_NAMES[(int)cursor_hit.face], cursor_hit.distance);
+      ImGui::Text("Cursor chunk: %.0f %.0f, lod %d, cube %d %d", cursor_hit.chunk_position.x, cursor_hit.chunk_position.y,
+                  cursor_hit.lod, cursor_hit.x, cursor_hit.y);
+    }
+    else
+    {
+      ImGui::Text("Cursor cube: none");
+    }
+    ImGui::Text("Cursor ray: %.0f us, %d chunks stepped, %d cubes tested", game_state->cursor_ray_us,
+                cursor_hit.n_chunks_stepped, cursor_hit.n_cubes_tested);
+
+    ToggleButton("Edit terrain", &game_state->edit_terrain);
+    if (game_state->edit_terrain)
+    {
+      ImGui::Combo("Brush", (int *)&game_state->brush_mode, "Raise\0Lower\0Flatten\0\0");
+      ImGui::DragFloat("Brush radius", &game_state->brush_radius, 0.1, 0.5, 64);
+      ImGui::DragFloat("Brush strength", &game_state->brush_strength, 0.01, 0, 4);
+      ImGui::Value("Edited chunks", game_state->terrain_edits.n_chunks);
+      ImGui::Value("Last edit us", (unsigned int)game_state->last_edit_us);
+      ImGui::Value("Last edit chunks rebuilt", game_state->last_edit_n_chunks);
+      ImGui::Value("Edit cells uploaded", game_state->n_edit_cells_uploaded);
+      if (ImGui::Button("Clear edits"))
+      {
+        terrain_edits_clear(&game_state->terrain_edits);
+        invalidate_terrain(game_state);
+        generate_terrain(game_state);
+      }
+    }
+
     ToggleButton("Capture Mouse", &game_state->capture_mouse);
     ToggleButton("Debug Camera", &game_state->debug_camera);
 
@@ -309,19 +2006,166 @@ render_window(GameState *game_state, float surface_height)
     {
       generate_terrain(game_state);
     }
+    ImGui::Value("Terrain generation ms", game_state->last_terrain_gen_us / 1000.0f);
+    ImGui::Value("Chunks generated", game_state->last_terrain_gen_n_chunks);
+    ImGui::Value("Chunks decoded", game_state->last_terrain_gen_n_decoded);
+
+    ToggleButton("Stream terrain", &game_state->stream_terrain);
+    ImGui::DragFloat("Stream budget ms", &game_state->stream_budget_ms, 0.1, 0, 16);
+    ImGui::Value("Stream queue depth", game_state->chunk_streamer->n_in_flight);
+    ImGui::Value("Chunks completed/s", game_state->chunk_streamer->completed_per_second);
+
+    if (game_state->gpu_terrain_available)
+    {
+      ToggleButton("Generate on GPU", &game_state->generate_on_gpu);
+      if (game_state->generate_on_gpu &&
+          game_state->terrain_parameters.noise_backend != NoiseBackend::Perlin)
+      {
+        ImGui::Text("Only Perlin noise is generated on the GPU");
+      }
+      ImGui::Value("GPU queue depth", (int)game_state->chunk_streamer->gpu_queued.size());
+      ImGui::Value("GPU batches in flight", game_state->gpu_terrain.n_in_flight);
+      ImGui::Value("GPU tiles generated", game_state->gpu_terrain.n_tiles_generated);
+    }
+    else
+    {
+      ImGui::Text("GPU terrain generation unavailable");
+    }
+
+    if (ImGui::Combo("Chunk store", (int *)&game_state->chunk_store, "Table\0Clipmap\0\0"))
+    {
+      invalidate_terrain(game_state);
+      generate_terrain(game_state);
+    }
+    if (game_state->chunk_store == ChunkStore::Clipmap)
+    {
+      ImGui::SliderInt("Clipmap size log2", &game_state->user_clipmap_size_log2, 1, 8);
+      ImGui::Value("Clipmap size", game_state->chunk_clipmap.size);
+      ImGui::Value("Clipmap MB", game_state->chunk_clipmap.size * game_state->chunk_clipmap.size * (sizeof(ChunkKey) + sizeof(TerrainChunk)) / (1024.0f * 1024.0f));
+    }
+
+    ToggleButton("Chunk LOD", &game_state->chunk_lod);
+    ImGui::DragFloat("Full detail distance", &game_state->lod_distance, 0.1, 1, 1024);
+    ImGui::DragFloat("LOD hysteresis", &game_state->lod_hysteresis, 0.01, 0, 0.5);
+    ImGui::Text("Chunks drawn per LOD: %d %d %d %d %d",
+                game_state->n_lod_chunks[0], game_state->n_lod_chunks[1], game_state->n_lod_chunks[2],
+                game_state->n_lod_chunks[3], game_state->n_lod_chunks[4]);
+
+#ifdef QUANTISE_HEIGHTS
+    ImGui::Text("Chunk heights: 16-bit quantised");
+#else
+    ImGui::Text("Chunk heights: float");
+#endif
+#ifdef CHUNK_HALO
+    ImGui::Text("Chunk halos: on");
+#else
+    ImGui::Text("Chunk halos: off");
+#endif
+    ImGui::Value("Chunk height and slope bytes", (int)(sizeof(TerrainChunk::height_map) + sizeof(TerrainChunk::slope_map)));
+    ImGui::Value("Max height quantisation error", game_state->max_height_quantisation_error);
+    ImGui::Value("Max slope quantisation error", game_state->max_slope_quantisation_error);
+    if (ImGui::Button("Reset quantisation error"))
+    {
+      game_state->max_height_quantisation_error = 0;
+      game_state->max_slope_quantisation_error = 0;
+    }
+
+    ChunkCache &cache = game_state->chunk_cache;
+    ToggleButton("Chunk cache", &game_state->use_chunk_cache);
+    ImGui::Value("Chunk cache hits", (unsigned int)cache.n_hits);
+    ImGui::Value("Chunk cache misses", (unsigned int)cache.n_misses);
+    ImGui::Value("Chunk cache hit rate", cache.n_hits + cache.n_misses ? (float)cache.n_hits / (cache.n_hits + cache.n_misses) : 0.0f);
+    ImGui::Value("Chunk cache entries", cache.n_entries);
+    ImGui::Value("Chunk cache evictions", (unsigned int)cache.n_evictions);
+    ImGui::Value("Chunk cache MB", (cache.capacity * (sizeof(ChunkCacheKey) + sizeof(ChunkCacheEntry)) + cache.n_data_bytes) / (1024.0f * 1024.0f));
+    ImGui::Value("Chunk cache bytes per chunk", cache.n_entries ? (float)cache.n_data_bytes / cache.n_entries : 0.0f);
+    ImGui::Value("Chunk cache compression ratio", cache.n_data_bytes ? (float)cache.n_entries * sizeof(ChunkMaps) / cache.n_data_bytes : 0.0f);
+    ImGui::Value("Max cache height error", game_state->max_codec_height_error);
+    ImGui::Value("Max cache slope error", game_state->max_codec_slope_error);
+    ImGui::Value("Generate us/chunk", game_state->chunk_generate_us);
+    ImGui::Value("Decode us/chunk", game_state->chunk_decode_us);
+    ImGui::Text("Cached chunks are %s", decode_is_cheaper(game_state) ? "decoded" : "generated again");
+    if (ImGui::Button("Reset cache stats"))
+    {
+      cache.n_hits = 0;
+      cache.n_misses = 0;
+      cache.n_evictions = 0;
+      game_state->max_codec_height_error = 0;
+      game_state->max_codec_slope_error = 0;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear chunk cache"))
+    {
+      chunk_cache_clear(&cache);
+    }
+
+    // Region files grow with every plan and stretch of terrain seen, so they
+    //   are only written, and their directory made, once turned on
+    ToggleButton("Region files", &game_state->use_chunk_region_store);
+    if (game_state->use_chunk_region_store &&
+        !game_state->chunk_region_store_available)
+    {
+      game_state->chunk_region_store_available = chunk_region_store_init(&game_state->chunk_region_store, CHUNK_REGION_DIRECTORY);
+      game_state->use_chunk_region_store = game_state->chunk_region_store_available;
+    }
+    if (game_state->chunk_region_store_available)
+    {
+      ChunkRegionStore &region_store = game_state->chunk_region_store;
+      ImGui::Value("Region file loads", (unsigned int)region_store.n_loads);
+      ImGui::Value("Region file misses", (unsigned int)region_store.n_misses);
+      ImGui::Value("Region file stores", (unsigned int)region_store.n_stores);
+      ImGui::Value("Stale regions cleared", (unsigned int)region_store.n_stale_regions);
+      ImGui::Value("Open regions", region_store.n_regions);
+      if (ImGui::Button("Reset region stats"))
+      {
+        region_store.n_loads = 0;
+        region_store.n_misses = 0;
+        region_store.n_stores = 0;
+        region_store.n_stale_regions = 0;
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Delete region files"))
+      {
+        chunk_region_store_clear(&region_store);
+      }
+    }
+
+    ChunkTable &table = game_state->chunk_table;
+    ImGui::DragFloat("Chunk memory budget MB", &game_state->chunk_memory_budget_mb, 1, 1, 16384);
+    ImGui::Value("Resident chunks", table.n_chunks);
+    ImGui::Value("Evicted chunks", game_state->n_evicted_chunks);
+    ImGui::Value("Chunk table capacity", table.capacity);
+    ImGui::Value("Chunk table load factor", (float)table.n_chunks / table.capacity);
+    ImGui::Value("Chunk table MB", table.capacity * (sizeof(ChunkKey) + sizeof(TerrainChunk)) / (1024.0f * 1024.0f));
+    ImGui::Value("Probes per lookup", table.n_lookups ? (float)table.n_probes / table.n_lookups : 0.0f);
+    ImGui::Value("Max probe length", table.max_probe_length);
+    if (ImGui::Button("Reset probe stats"))
+    {
+      table.n_lookups = 0;
+      table.n_probes = 0;
+      table.max_probe_length = 0;
+    }
 
-    ImGui::DragInt("Number of Perlins", &game_state->n_perlins, 0.2, 0, ARRAY_COUNT(game_state->perlin_periods));
+    TerrainParameters &parameters = game_state->terrain_parameters;
+    ImGui::Combo("Noise backend", (int *)&parameters.noise_backend, NOISE_BACKEND_NAMES);
+    ImGui::DragInt("Number of Perlins", &parameters.n_perlins, 0.2, 0, ARRAY_COUNT(parameters.perlin_periods));
     for (int perlin_n = 0;
-         perlin_n < game_state->n_perlins;
+         perlin_n < parameters.n_perlins;
          ++perlin_n)
     {
       ImGui::PushID(perlin_n);
-      ImGui::DragInt("Perlin period", &game_state->perlin_periods[perlin_n], 1, 1, 1024);
-      ImGui::DragFloat("Perlin amplitude", &game_state->perlin_amplitudes[perlin_n], 0.1, 0, 1024);
+      ImGui::DragInt("Perlin period", &parameters.perlin_periods[perlin_n], 1, 1, 1024);
+      ImGui::DragFloat("Perlin amplitude", &parameters.perlin_amplitudes[perlin_n], 0.1, 0, 1024);
       ImGui::PopID();
     }
+    ImGui::Value("Requested octaves", parameters.n_perlins);
+    ImGui::Value("Planned octaves", plan_octaves(parameters).n_octaves);
 
     ImGui::Combo("Sine Offset Type", (int*)&game_state->sine_offset_type, "Diagonal\0Concentric\0\0");
+    ToggleButton("Smooth shading", &game_state->smooth_shading);
+
+    vec2 slope = get_terrain_slope_for_global_position(game_state, {game_state->camera_position.x, game_state->camera_position.z});
+    ImGui::Value("Slope under camera", vec2Length(slope));
     ImGui::DragFloat("Bounces Per Second", &game_state->bounces_per_second, 0.01, 0, 10);
     ImGui::DragFloat("Oscillation Frequency", &game_state->oscillation_frequency, 0.01, 0, 10);
     ImGui::DragFloat("Bounce Height", &game_state->bounce_height, 0.1, 0, 100);
@@ -346,6 +2190,119 @@ render_window(GameState *game_state, float surface_height)
       ImGui::ColorPicker3("##picker", (float*)&game_state->colours[game_state->colour_picker_n]);
       ImGui::EndPopup();
     }
+
+    if (ImGui::CollapsingHeader("Benchmarks"))
+    {
+      BenchmarkResults &results = game_state->benchmark_results;
+
+      if (ImGui::Button("Run noise benchmark"))
+      {
+        run_noise_benchmark(&results);
+      }
+      ImGui::Value("perlin() before gradient table ns/sample", results.perlin_reference_ns_per_sample);
+      ImGui::Value("perlin() ns/sample", results.perlin_ns_per_sample);
+      ImGui::Value("perlin_tile() ns/sample", results.perlin_tile_ns_per_sample);
+      ImGui::Value("perlin_tile_rows() ns/sample", results.perlin_tile_rows_ns_per_sample);
+      ImGui::Value("Generic octaves ns/sample", results.octaves_generic_ns_per_sample);
+      ImGui::Value("Specialised octaves ns/sample", results.octaves_specialised_ns_per_sample);
+      ImGui::Value("simplex() ns/sample", results.simplex_ns_per_sample);
+      ImGui::Value("simplex_tile() ns/sample", results.simplex_tile_ns_per_sample);
+
+      if (ImGui::Button("Run chunk lookup benchmark"))
+      {
+        run_chunk_lookup_benchmark(&results);
+      }
+      for (int load_n = 0;
+           load_n < N_CHUNK_LOOKUP_BENCHMARK_LOADS;
+           ++load_n)
+      {
+        ImGui::Text("Load %.2f: hit %.1f ns, miss %.1f ns, %.2f probes/hit",
+                    CHUNK_LOOKUP_BENCHMARK_LOADS[load_n],
+                    results.chunk_hit_ns[load_n],
+                    results.chunk_miss_ns[load_n],
+                    results.chunk_probes_per_hit[load_n]);
+      }
+
+      if (game_state->gpu_terrain_available &&
+          ImGui::Button("Check GPU terrain against CPU"))
+      {
+        // The check needs the GPU's batches to itself
+        stream_gpu_chunks(game_state, true);
+        run_gpu_terrain_check(&results, &game_state->gpu_terrain, &game_state->octave_plan);
+      }
+      ImGui::Value("GPU max height error", results.gpu_height_max_error);
+      ImGui::Value("GPU max slope error", results.gpu_slope_max_error);
+      ImGui::Value("GPU us/chunk", results.gpu_chunk_us);
+      ImGui::Value("CPU us/chunk", results.cpu_chunk_us);
+
+      if (ImGui::Button("Run region file benchmark"))
+      {
+        run_chunk_region_benchmark(&results, &game_state->octave_plan);
+      }
+      ImGui::Value("Generate us/chunk", results.region_generate_chunk_us);
+      ImGui::Value("Region store us/chunk", results.region_store_chunk_us);
+      ImGui::Value("Region load us/chunk", results.region_load_chunk_us);
+      ImGui::Value("Region load max error", results.region_load_max_error);
+
+      if (ImGui::Button("Run chunk compression benchmark"))
+      {
+        run_chunk_codec_benchmark(&results, &game_state->octave_plan);
+      }
+      ImGui::Value("Generate us/chunk", results.codec_generate_chunk_us);
+      ImGui::Value("Encode us/chunk", results.codec_encode_chunk_us);
+      ImGui::Value("Decode us/chunk", results.codec_decode_chunk_us);
+      ImGui::Value("Compressed bytes/chunk", results.codec_bytes_per_chunk);
+      ImGui::Value("Compression ratio", results.codec_ratio);
+      ImGui::Value("Decoded max height error", results.codec_max_height_error);
+      ImGui::Value("Decoded max slope error", results.codec_max_slope_error);
+
+      if (ImGui::Button("Run chunk bounds benchmark"))
+      {
+        run_chunk_bounds_benchmark(&results, &game_state->octave_plan);
+      }
+      ImGui::Value("Generate us/chunk", results.bounds_generate_chunk_us);
+      ImGui::Value("Store us/chunk", results.bounds_store_chunk_us);
+      ImGui::Value("Build bounds us/chunk", results.bounds_build_chunk_us);
+
+      if (ImGui::Button("Run height query benchmark"))
+      {
+        run_height_query_benchmark(&results, game_state);
+      }
+      ImGui::Text("%d heights, us: single %.1f, batched %.1f, bilinear with normals %.1f",
+                  BENCHMARK_N_HEIGHT_QUERIES, results.height_query_single_us,
+                  results.height_query_batch_us, results.height_query_bilinear_us);
+      ImGui::Text("%d clustered heights, us: single %.1f, batched %.1f, bilinear with normals %.1f",
+                  BENCHMARK_N_HEIGHT_QUERIES, results.height_query_clustered_single_us,
+                  results.height_query_clustered_batch_us, results.height_query_clustered_bilinear_us);
+      ImGui::Value("Batched max difference", results.height_query_max_difference);
+
+      if (ImGui::Button("Run ray cast benchmark"))
+      {
+        run_ray_cast_benchmark(&results, game_state);
+      }
+      ImGui::Text("%d rays, us/ray: %.2f, chunks stepped %.1f, cubes tested %.1f, hit %.2f",
+                  BENCHMARK_N_RAYS, results.ray_cast_us, results.ray_cast_chunks_stepped,
+                  results.ray_cast_cubes_tested, results.ray_cast_hit_fraction);
+      ImGui::Text("Rays disagreeing with every cube tested: %d of %d", results.ray_cast_n_mismatches, results.ray_cast_n_checked);
+
+      if (ImGui::Button("Run terrain edit benchmark"))
+      {
+        run_terrain_edit_benchmark(&results, game_state);
+      }
+      ImGui::Text("Stroke of %d brushes over %d chunks: %.2f ms, %.1f us/brush",
+                  BENCHMARK_N_BRUSH_STEPS, results.edit_stroke_n_chunks, results.edit_stroke_ms, results.edit_brush_us);
+      ImGui::Value("Edited max difference from generated", results.edit_max_difference);
+
+#ifdef CHUNK_HALO
+      if (ImGui::Button("Run chunk halo benchmark"))
+      {
+        run_chunk_halo_benchmark(&results, game_state);
+      }
+      ImGui::Text("Gradients of %d chunks, us: halo stencil %.1f, neighbour lookups %.1f",
+                  results.halo_n_chunks, results.halo_stencil_us, results.halo_lookup_us);
+      ImGui::Value("Halo max difference", results.halo_max_difference);
+#endif
+    }
   }
 
   ImGui::End();
@@ -363,6 +2320,7 @@ init_game_state(GameState *game_state)
   game_state->fov = 45.0f;
   game_state->terrain_rotation = {};
   game_state->sine_offset_type = SineOffsetType::Concentric;
+  game_state->smooth_shading = false;
   game_state->bounces_per_second = 0;
   game_state->oscillation_frequency = 0;
   game_state->bounce_height = 1;
@@ -380,16 +2338,49 @@ init_game_state(GameState *game_state)
   game_state->colours[1] = {0.5f, 0.5f, 0.5f, 1};
 
   game_state->user_terrain_dim = {5, 5};
-  game_state->n_perlins = 15;
+  game_state->terrain_parameters.noise_backend = NoiseBackend::Perlin;
+  game_state->terrain_parameters.n_perlins = 15;
   for (int perlin_n = 0;
-       perlin_n < ARRAY_COUNT(game_state->perlin_periods);
+       perlin_n < ARRAY_COUNT(game_state->terrain_parameters.perlin_periods);
        ++perlin_n)
   {
-    game_state->perlin_periods[perlin_n] = 16;
-    game_state->perlin_amplitudes[perlin_n] = 1;
+    game_state->terrain_parameters.perlin_periods[perlin_n] = 16;
+    game_state->terrain_parameters.perlin_amplitudes[perlin_n] = 1;
   }
 
-  game_state->terrain_gen_id = 0;
+  // Leave the calling thread free to help with parallel_for()
+  game_state->worker_pool = new WorkerPool();
+  worker_pool_init(game_state->worker_pool, std::max(2u, std::thread::hardware_concurrency()) - 1);
+
+  game_state->chunk_streamer = new ChunkStreamer();
+  game_state->stream_terrain = true;
+  game_state->stream_budget_ms = 2;
+  game_state->generate_on_gpu = false;
+
+  game_state->use_chunk_cache = true;
+  chunk_cache_init(&game_state->chunk_cache, CHUNK_CACHE_CAPACITY);
+
+  game_state->chunk_region_store_available = false;
+  game_state->use_chunk_region_store = false;
+
+  game_state->frustum_culling = true;
+
+  terrain_edits_init(&game_state->terrain_edits, 64);
+  game_state->edit_terrain = false;
+  game_state->brush_mode = BrushMode::Raise;
+  game_state->brush_radius = 4;
+  game_state->brush_strength = 0.1;
+
+  game_state->chunk_lod = true;
+  game_state->lod_distance = 8;
+  game_state->lod_hysteresis = 0.1;
+
+  game_state->chunk_store = ChunkStore::Table;
+  chunk_table_init(&game_state->chunk_table, 1024);
+  game_state->chunk_memory_budget_mb = 256;
+  game_state->user_clipmap_size_log2 = 5;
+  chunk_clipmap_init(&game_state->chunk_clipmap, game_state->user_clipmap_size_log2);
+  invalidate_terrain(game_state);
   generate_terrain(game_state);
 
   game_state->light_position = {0, 10, 0};
@@ -414,8 +2405,20 @@ init_game_state(GameState *game_state)
 
   game_state->program_id = LoadShaders( "TransformVertexShader.vertexshader", "ColorFragmentShader.fragmentshader" );
 
+  game_state->gpu_terrain_available = gpu_terrain_init(&game_state->gpu_terrain, CHUNK_SIZE);
+
   game_state->world_view_projection_matrix_uniform = glGetUniformLocation(game_state->program_id, "WORLD_VIEW_PROJECTION");
-  game_state->model_matrix_uniform = glGetUniformLocation(game_state->program_id, "MODEL");
+  game_state->chunk_position_uniform = glGetUniformLocation(game_state->program_id, "CHUNK_POSITION");
+  game_state->bounce_phase_uniform = glGetUniformLocation(game_state->program_id, "BOUNCE_PHASE");
+  game_state->bounce_height_uniform = glGetUniformLocation(game_state->program_id, "BOUNCE_HEIGHT");
+  game_state->oscillation_frequency_uniform = glGetUniformLocation(game_state->program_id, "OSCILLATION_FREQUENCY");
+  game_state->sine_offset_type_uniform = glGetUniformLocation(game_state->program_id, "SINE_OFFSET_TYPE");
+  game_state->smooth_shading_uniform = glGetUniformLocation(game_state->program_id, "SMOOTH_SHADING");
+  game_state->lod_uniform = glGetUniformLocation(game_state->program_id, "LOD");
+  game_state->height_base_uniform = glGetUniformLocation(game_state->program_id, "HEIGHT_BASE");
+  game_state->height_scale_uniform = glGetUniformLocation(game_state->program_id, "HEIGHT_SCALE");
+  game_state->slope_scale_uniform = glGetUniformLocation(game_state->program_id, "SLOPE_SCALE");
+  game_state->terrain_dim_uniform = glGetUniformLocation(game_state->program_id, "TERRAIN_DIM");
   game_state->light_position_uniform = glGetUniformLocation(game_state->program_id, "LIGHT_POSITION");
   game_state->light_colour_uniform = glGetUniformLocation(game_state->program_id, "LIGHT_COLOUR");
   game_state->ambient_light_uniform = glGetUniformLocation(game_state->program_id, "AMBIENT_LIGHT_COLOUR");
@@ -791,22 +2794,46 @@ main_loop(GameState *game_state, vec2 mouse_delta)
   // Generate new chunks
   //
 
+  if (game_state->gpu_terrain_available)
+  {
+    stream_gpu_chunks(game_state, false);
+  }
+  integrate_streamed_chunks(game_state);
+
+  // Start writing this frame's chunks back while they are fresh
+  if (game_state->use_chunk_region_store)
+  {
+    chunk_region_store_flush(&game_state->chunk_region_store);
+  }
+
   bool regenerate = false;
 
   vec2 position = {game_state->camera_position.x, game_state->camera_position.z};
   vec2 chunk_position = get_chunk_position(position);
 
-  if (chunk_position.x < -floorf(game_state->current_terrain_dim.x*0.5) ||
-      chunk_position.x >= floorf(game_state->current_terrain_dim.x*0.5))
+  // The clipmap follows the camera instead of growing
+  if (game_state->chunk_store == ChunkStore::Table)
   {
-    game_state->user_terrain_dim.x = game_state->current_terrain_dim.x + 1;
-    regenerate = true;
+    if (chunk_position.x < -floorf(game_state->current_terrain_dim.x*0.5) ||
+        chunk_position.x >= floorf(game_state->current_terrain_dim.x*0.5))
+    {
+      game_state->user_terrain_dim.x = game_state->current_terrain_dim.x + 1;
+      regenerate = true;
+    }
+
+    if (chunk_position.y < -floorf(game_state->current_terrain_dim.y*0.5) ||
+        chunk_position.y >= floorf(game_state->current_terrain_dim.y*0.5))
+    {
+      game_state->user_terrain_dim.y = game_state->current_terrain_dim.y + 1;
+      regenerate = true;
+    }
   }
 
-  if (chunk_position.y < -floorf(game_state->current_terrain_dim.y*0.5) ||
-      chunk_position.y >= floorf(game_state->current_terrain_dim.y*0.5))
+  // Chunks near the camera may have been evicted while it was far away, or the
+  //   clipmap's window needs to move
+  if (!vec2Equal(chunk_position, game_state->camera_chunk_position))
   {
-    game_state->user_terrain_dim.y = game_state->current_terrain_dim.y + 1;
+    game_state->camera_chunk_position = chunk_position;
     regenerate = true;
   }
 
@@ -839,6 +2866,43 @@ main_loop(GameState *game_state, vec2 mouse_delta)
   mat4x4 world_view_projection;
   mat4x4MultiplyMatrix(world_view_projection, world, view_projection);
 
+  // The per-cube bounce is evaluated in the vertex shader, so only the phase is uploaded per frame
+  float bounces_per_us = game_state->bounces_per_second / 1000000.0;
+  game_state->bounce_phase = fmod(frame_time * bounces_per_us, 1.0) * 2*M_PI;
+
+  // Pick the terrain under the cursor
+  //
+
+  vec2 cursor = game_state->capture_mouse ? vec2Multiply({io.DisplaySize.x, io.DisplaySize.y}, 0.5) : vec2{io.MousePos.x, io.MousePos.y};
+  vec2 cursor_ndc = {2*cursor.x/io.DisplaySize.x - 1, 1 - 2*cursor.y/io.DisplaySize.y};
+
+  // Unprojected from the near and far planes into the terrain's space
+  mat4x4 inverse_world_view_projection;
+  mat4x4Inverse(inverse_world_view_projection, world_view_projection);
+  vec4 near = mat4x4MultiplyVector(inverse_world_view_projection, {cursor_ndc.x, cursor_ndc.y, -1, 1});
+  vec4 far = mat4x4MultiplyVector(inverse_world_view_projection, {cursor_ndc.x, cursor_ndc.y, 1, 1});
+  vec3 ray_origin = vec3Multiply(near.xyz, 1/near.w);
+  vec3 ray_end = vec3Multiply(far.xyz, 1/far.w);
+  vec3 ray_direction = vec3Subtract(ray_end, ray_origin);
+
+  uint64_t ray_start_us = get_us();
+  game_state->cursor_ray_hit = cast_terrain_ray(game_state, ray_origin, ray_direction, vec3Length(ray_direction), &game_state->cursor_hit);
+  game_state->cursor_ray_us = get_us() - ray_start_us;
+
+  // Paint the terrain under the cursor while the left button is held
+  //
+
+  if (game_state->edit_terrain && game_state->cursor_ray_hit &&
+      io.MouseDown[0] && !io.WantCaptureMouse)
+  {
+    vec2 brush_centre = {game_state->cursor_hit.position.x, game_state->cursor_hit.position.z};
+    if (io.MouseClicked[0])
+    {
+      game_state->brush_target_height = get_terrain_height_for_global_position(game_state, brush_centre);
+    }
+    apply_terrain_brush(game_state, brush_centre, game_state->brush_target_height);
+  }
+
   // Upload colours to colour buffer
   //
 
@@ -942,56 +3006,118 @@ main_loop(GameState *game_state, vec2 mouse_delta)
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, game_state->index_buffer);
 
-  float bounces_per_us = game_state->bounces_per_second / 1000000.0;
+  glUniform1f(game_state->bounce_phase_uniform, game_state->bounce_phase);
+  glUniform1f(game_state->bounce_height_uniform, game_state->bounce_height);
+  glUniform1f(game_state->oscillation_frequency_uniform, game_state->oscillation_frequency);
+  glUniform1i(game_state->sine_offset_type_uniform, (int)game_state->sine_offset_type);
+  glUniform1i(game_state->smooth_shading_uniform, game_state->smooth_shading);
+  glUniform2fv(game_state->terrain_dim_uniform, 1, (float *)&game_state->current_terrain_dim.v);
+
+  // One instanced draw per chunk, each instance is one cube of the chunk's height map
+  glEnableVertexAttribArray(INSTANCE_HEIGHT_ATTRIBUTE);
+  glVertexAttribDivisor(INSTANCE_HEIGHT_ATTRIBUTE, 1);
+  glEnableVertexAttribArray(INSTANCE_SLOPE_ATTRIBUTE);
+  glVertexAttribDivisor(INSTANCE_SLOPE_ATTRIBUTE, 1);
+
+  game_state->n_draw_calls = 0;
+  game_state->n_cubes_drawn = 0;
+  game_state->n_culled_chunks = 0;
+  game_state->n_edit_cells_uploaded = 0;
+  for (int lod = 0;
+       lod < CHUNK_N_LODS;
+       ++lod)
+  {
+    game_state->n_lod_chunks[lod] = 0;
+  }
 
-  for (chunk_position.x = -floorf(game_state->current_terrain_dim.x*0.5);
-       chunk_position.x < floorf(game_state->current_terrain_dim.x*0.5);
-       ++chunk_position.x)
-  for (chunk_position.y = -floorf(game_state->current_terrain_dim.y*0.5);
-       chunk_position.y < floorf(game_state->current_terrain_dim.y*0.5);
+  vec2 terrain_min, terrain_max;
+  get_terrain_bounds(game_state, &terrain_min, &terrain_max);
+
+  // In the terrain's own space, before world's rotation
+  Frustum frustum;
+  get_frustum(world_view_projection, &frustum);
+
+  // Row by row, so the clipmap's cells are visited in memory order
+  for (chunk_position.y = terrain_min.y;
+       chunk_position.y < terrain_max.y;
        ++chunk_position.y)
+  for (chunk_position.x = terrain_min.x;
+       chunk_position.x < terrain_max.x;
+       ++chunk_position.x)
   {
-    TerrainChunk &terrain_chunk = get_terrain_chunk(game_state, chunk_position);
-
-    vec2 translation;
-    for (translation.x = 0;
-         translation.x < CHUNK_SIZE;
-         ++translation.x)
-    for (translation.y = 0;
-         translation.y < CHUNK_SIZE;
-         ++translation.y)
+    // Chunks still being generated are skipped until they are ready
+    TerrainChunk *terrain_chunk = find_chunk(game_state, chunk_position);
+    if (!terrain_chunk || !terrain_chunk->ready)
     {
-      mat4x4 cube;
-      mat4x4Identity(cube);
-      mat4x4Scale(cube, 0.5);
-      vec2 global_position = vec2Add(vec2Multiply(chunk_position, CHUNK_SIZE), translation);
-      mat4x4Translate(cube, {global_position.x, 0, global_position.y});
+      continue;
+    }
 
-      float terrain_offset = get_height_from_chunk(terrain_chunk, translation);
-      mat4x4Translate(cube, {0, terrain_offset, 0});
+    int lod = update_render_lod(game_state, terrain_chunk, get_chunk_lod_distance(game_state, chunk_position));
+    int lod_offset = chunk_lod_offset(lod);
+    vec2 chunk_origin = vec2Multiply(chunk_position, CHUNK_SIZE);
 
-      float sine_offset = 0;
-      switch (game_state->sine_offset_type)
+    // Cubes reach half a cube above their heights and are as deep as they are
+    //   wide, and bounce by up to bounce_height, see TransformVertexShader
+    if (game_state->frustum_culling)
+    {
+      float cube_size = 1 << lod;
+      float bounce_height = fabsf(game_state->bounce_height);
+      vec3 box_min = {chunk_origin.x - 0.5f, terrain_chunk->min_height + 0.5f - cube_size - bounce_height, chunk_origin.y - 0.5f};
+      vec3 box_max = {chunk_origin.x + CHUNK_SIZE - 0.5f, terrain_chunk->max_height + 0.5f + bounce_height, chunk_origin.y + CHUNK_SIZE - 0.5f};
+      if (box_outside_frustum(frustum, box_min, box_max))
       {
-        case (SineOffsetType::Diagonal):
-        {
-          sine_offset = (translation.x/game_state->current_terrain_dim.x + translation.y/game_state->current_terrain_dim.y) * game_state->oscillation_frequency*2*M_PI;
-        } break;
-        case (SineOffsetType::Concentric):
-        {
-          sine_offset = vec2Length(translation) / (0.5 * vec2Length(game_state->current_terrain_dim)) * game_state->oscillation_frequency*2*M_PI;
-        } break;
+        ++game_state->n_culled_chunks;
+        continue;
       }
-
-      float offset = sin(frame_time * bounces_per_us * 2*M_PI + sine_offset) * game_state->bounce_height;
-
-      mat4x4Translate(cube, {0, offset, 0});
-      glUniformMatrix4fv(game_state->model_matrix_uniform, 1, GL_FALSE, &cube[0][0]);
-      glDrawElements(GL_TRIANGLES, game_state->n_indices, GL_UNSIGNED_BYTE, 0);
     }
 
+    if (terrain_chunk->height_buffer_dirty)
+    {
+      upload_chunk_heights(*terrain_chunk);
+    }
+    else if (terrain_chunk->dirty_cells_end > terrain_chunk->dirty_cells_start)
+    {
+      game_state->n_edit_cells_uploaded += upload_chunk_dirty_cells(*terrain_chunk);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, terrain_chunk->height_buffer);
+
+    glVertexAttribPointer(
+      INSTANCE_HEIGHT_ATTRIBUTE,
+      1,                  // size
+      CHUNK_MAP_GL_TYPE,  // type
+      GL_FALSE,           // normalized?
+      0,                  // stride
+      (void*)(lod_offset * sizeof(ChunkHeight))  // array buffer offset
+    );
+
+    glVertexAttribPointer(
+      INSTANCE_SLOPE_ATTRIBUTE,
+      2,                  // size
+      CHUNK_MAP_GL_TYPE,  // type
+      GL_FALSE,           // normalized?
+      0,                  // stride
+      (void*)(SLOPE_BUFFER_OFFSET + lod_offset * sizeof(ChunkSlope))  // array buffer offset
+    );
+
+    glUniform1f(game_state->height_base_uniform, terrain_chunk->height_base);
+    glUniform1f(game_state->height_scale_uniform, terrain_chunk->height_scale);
+    glUniform1f(game_state->slope_scale_uniform, terrain_chunk->slope_scale);
+
+    glUniform2fv(game_state->chunk_position_uniform, 1, (float *)&chunk_origin.v);
+    glUniform1i(game_state->lod_uniform, lod);
+
+    int n_cubes = chunk_lod_size(lod) * chunk_lod_size(lod);
+    glDrawElementsInstanced(GL_TRIANGLES, game_state->n_indices, GL_UNSIGNED_BYTE, 0, n_cubes);
+    ++game_state->n_draw_calls;
+    ++game_state->n_lod_chunks[lod];
+    game_state->n_cubes_drawn += n_cubes;
   }
 
+  glVertexAttribDivisor(INSTANCE_HEIGHT_ATTRIBUTE, 0);
+  glDisableVertexAttribArray(INSTANCE_HEIGHT_ATTRIBUTE);
+  glVertexAttribDivisor(INSTANCE_SLOPE_ATTRIBUTE, 0);
+  glDisableVertexAttribArray(INSTANCE_SLOPE_ATTRIBUTE);
+
   glDisableVertexAttribArray(0);
   glDisableVertexAttribArray(1);
 
@@ -1021,4 +3147,53 @@ shutdown(GameState *game_state)
   glDeleteBuffers(1, &game_state->vertex_buffer);
   glDeleteBuffers(1, &game_state->index_buffer);
   glDeleteBuffers(1, &game_state->color_buffer);
+
+  // Every job queued is a stream_chunk_request_job() owning its request
+  std::vector<WorkJob> unrun_jobs;
+  worker_pool_shutdown(game_state->worker_pool, &unrun_jobs);
+  delete game_state->worker_pool;
+
+  for (const WorkJob &job : unrun_jobs)
+  {
+    delete (ChunkRequest *)job.data;
+  }
+  for (ChunkRequest *request : game_state->chunk_streamer->completed)
+  {
+    delete request;
+  }
+  for (ChunkRequest *request : game_state->chunk_streamer->integrating)
+  {
+    delete request;
+  }
+  for (ChunkRequest *request : game_state->chunk_streamer->gpu_queued)
+  {
+    delete request;
+  }
+
+  if (game_state->gpu_terrain_available)
+  {
+    // Batches still in flight hold their requests as tile tags
+    GpuTerrainBatch *batch;
+    while ((batch = gpu_terrain_map_finished(&game_state->gpu_terrain, true)))
+    {
+      for (int tile_n = 0;
+           tile_n < batch->n_tiles;
+           ++tile_n)
+      {
+        delete (ChunkRequest *)batch->tile_tags[tile_n];
+      }
+      gpu_terrain_release(&game_state->gpu_terrain, batch);
+    }
+    gpu_terrain_free(&game_state->gpu_terrain);
+  }
+  delete game_state->chunk_streamer;
+
+  chunk_table_free(&game_state->chunk_table);
+  chunk_clipmap_free(&game_state->chunk_clipmap);
+  chunk_cache_free(&game_state->chunk_cache);
+  terrain_edits_free(&game_state->terrain_edits);
+  if (game_state->chunk_region_store_available)
+  {
+    chunk_region_store_free(&game_state->chunk_region_store);
+  }
 }
\ No newline at end of file
@@ -1,8 +1,21 @@
 #ifndef MAIN_LOOP_H_DEF
 #define MAIN_LOOP_H_DEF
 
+#include "benchmark.h"
 #include "ccVector.h"
+#include "chunk-cache.h"
+#include "chunk-clipmap.h"
+#include "chunk-region.h"
+#include "chunk-table.h"
+#include "gpu-terrain.h"
+#include "noise.h"
+#include "terrain-edits.h"
 #include <GL/gl3w.h>
+#include <stdint.h>
+
+
+struct WorkerPool;
+struct ChunkStreamer;
 
 
 enum struct SineOffsetType
@@ -11,13 +24,73 @@ enum struct SineOffsetType
   Concentric
 };
 
-const int CHUNK_SIZE = 16;
+enum struct ChunkStore
+{
+  // Grows with the terrain, chunks are evicted by distance under a memory budget
+  Table,
+  // Fixed window of chunks which follows the camera
+  Clipmap
+};
+
+struct TerrainParameters
+{
+  NoiseBackend noise_backend;
+  int n_perlins;
+  int perlin_periods[16];
+  float perlin_amplitudes[16];
+};
+
+/// TerrainParameters reduced to the octaves which need evaluating, see
+///   plan_octaves().
+struct OctavePlan
+{
+  NoiseBackend noise_backend;
+  int n_octaves;
+  int periods[16];
+  float amplitudes[16];
+
+  // Equal for plans which generate the same terrain, keys the chunk cache
+  uint64_t hash;
+};
+
+enum struct CubeFace
+{
+  // The ray started inside the cube
+  Inside,
+  NegativeX,
+  PositiveX,
+  Bottom,
+  Top,
+  NegativeZ,
+  PositiveZ
+};
+
+enum struct BrushMode
+{
+  Raise,
+  Lower,
+  // Toward the height under the brush when the stroke started
+  Flatten
+};
 
-struct TerrainChunk
+/// Where a ray cast by cast_terrain_ray() first meets a cube.
+struct TerrainRayHit
 {
-  int terrain_gen_id;
-  vec2 position;
-  float height_map[CHUNK_SIZE*CHUNK_SIZE];
+  // The cube is cube x, y of level lod of the chunk at chunk_position, centred
+  //   on cube_position
+  vec2 chunk_position;
+  int lod;
+  int x;
+  int y;
+  vec2 cube_position;
+
+  CubeFace face;
+  float distance;
+  vec3 position;
+
+  // Work done by the cast, hit or not
+  int n_chunks_stepped;
+  int n_cubes_tested;
 };
 
 struct GameState
@@ -25,7 +98,17 @@ struct GameState
   GLint program_id;
 
   GLint world_view_projection_matrix_uniform;
-  GLint model_matrix_uniform;
+  GLint chunk_position_uniform;
+  GLint bounce_phase_uniform;
+  GLint bounce_height_uniform;
+  GLint oscillation_frequency_uniform;
+  GLint sine_offset_type_uniform;
+  GLint smooth_shading_uniform;
+  GLint lod_uniform;
+  GLint height_base_uniform;
+  GLint height_scale_uniform;
+  GLint slope_scale_uniform;
+  GLint terrain_dim_uniform;
   GLint light_position_uniform;
   GLint light_colour_uniform;
   GLint ambient_light_uniform;
@@ -53,24 +136,105 @@ struct GameState
   uint64_t game_start_time;
   float last_frame_delta;
   float last_frame_total;
+  int n_draw_calls;
+  int n_cubes_drawn;
+
+  bool frustum_culling;
+  int n_culled_chunks;
+  int n_lod_chunks[CHUNK_N_LODS];
+
+  // The terrain under the mouse cursor, or the centre of the screen while the
+  //   mouse is captured, as of the last frame
+  bool cursor_ray_hit;
+  TerrainRayHit cursor_hit;
+  float cursor_ray_us;
+
+  // Height deltas painted onto the terrain, see terrain-edits.h
+  TerrainEdits terrain_edits;
+  bool edit_terrain;
+  BrushMode brush_mode;
+  // In cubes, and cubes per frame at the brush's centre
+  float brush_radius;
+  float brush_strength;
+  float brush_target_height;
+
+  uint64_t last_edit_us;
+  int last_edit_n_chunks;
+  // Cells uploaded for edited chunks last frame, see upload_chunk_dirty_cells()
+  int n_edit_cells_uploaded;
+
+  BenchmarkResults benchmark_results;
+
+  WorkerPool *worker_pool;
+
+  ChunkStreamer *chunk_streamer;
+  bool stream_terrain;
+  float stream_budget_ms;
+
+  ChunkStore chunk_store;
+
+  ChunkTable chunk_table;
+  float chunk_memory_budget_mb;
+  int n_evicted_chunks;
+  vec2 camera_chunk_position;
+
+  ChunkClipmap chunk_clipmap;
+  int user_clipmap_size_log2;
+
+  bool chunk_lod;
+  // In chunks, see get_lod_start_distance()
+  float lod_distance;
+  float lod_hysteresis;
+
+  ChunkCache chunk_cache;
+  bool use_chunk_cache;
+
+  // Moving averages of the workers' time per chunk, deciding whether cached
+  //   chunks are decoded or generated again, see decode_is_cheaper()
+  float chunk_generate_us;
+  float chunk_decode_us;
+
+  // Largest rounding of chunks compressed into the chunk cache
+  float max_codec_height_error;
+  float max_codec_slope_error;
+
+  // Opened the first time region files are turned on
+  ChunkRegionStore chunk_region_store;
+  bool chunk_region_store_available;
+  bool use_chunk_region_store;
+
+  // Largest difference between stored and generated chunk data, see store_chunk_maps()
+  float max_height_quantisation_error;
+  float max_slope_quantisation_error;
+
+  GpuTerrain gpu_terrain;
+  bool gpu_terrain_available;
+  bool generate_on_gpu;
 
-  TerrainChunk terrain_chunk_hashmap[1024];
-  int terrain_gen_id;
   vec2 current_terrain_dim;
+  uint64_t last_terrain_gen_us;
+  int last_terrain_gen_n_chunks;
+  int last_terrain_gen_n_decoded;
 
   vec2 user_terrain_dim;
 
-  int n_perlins;
-  int perlin_periods[16];
-  float perlin_amplitudes[16];
+  TerrainParameters terrain_parameters;
+
+  // The parameters the chunks of the current terrain_gen_id were generated with
+  TerrainParameters generated_terrain_parameters;
+  OctavePlan octave_plan;
 
   float fov;
   vec3 terrain_rotation;
   SineOffsetType sine_offset_type;
+  bool smooth_shading;
   float bounces_per_second;
   float bounce_height;
   float oscillation_frequency;
 
+  // Of the frame being drawn, see get_cube_bounce()
+  float bounce_phase;
+
   vec4 colours[2];
   int colour_picker_n;
 
@@ -92,6 +256,61 @@ struct GameState
   vec3 camera_direction;
 };
 
+uint64_t
+get_us();
+
+/// Fill a chunk's height map from an octave plan at level of detail lod, and
+///   the coarser levels from that.
+void
+generate_chunk(const OctavePlan *plan, vec2 chunk_position, int lod, float *height_map, vec2 *slope_map);
+
+/// Return the chunk at position from the active chunk store, or 0 if it is not
+///   resident.
+TerrainChunk *
+find_chunk(GameState *game_state, vec2 position);
+
+/// The range of chunk positions [min, max) making up the terrain.
+void
+get_terrain_bounds(GameState *game_state, vec2 *min, vec2 *max);
+
+float
+get_terrain_height_for_global_position(GameState *game_state, vec2 position);
+
+/// Fill heights, and normals unless it is 0, with the terrain at each of the
+///   n_positions global XZ positions, 0 and straight up where no chunk is
+///   ready. Nearest samples are the cube under each position, as
+///   get_terrain_height_for_global_position(), and bilinear samples
+///   interpolate between the four nearest cube centres.
+void
+get_terrain_heights(GameState *game_state, int n_positions, const vec2 *positions, bool bilinear, float *heights, vec3 *normals);
+
+/// The vertical offset of a cube of a chunk from its height, as
+///   TransformVertexShader bounces it, translation being the cube's centre from
+///   the chunk's origin.
+float
+get_cube_bounce(GameState *game_state, vec2 translation);
+
+/// Cast a ray from origin along direction, in the terrain's space before its
+///   rotation, against the cubes drawn, returning whether it meets one within
+///   max_distance and filling hit either way.
+bool
+cast_terrain_ray(GameState *game_state, vec3 origin, vec3 direction, float max_distance, TerrainRayHit *hit);
+
+/// The height delta of the full resolution cube at global position x, y.
+float
+get_terrain_delta(GameState *game_state, int x, int y);
+
+/// Set the height deltas of the full resolution cubes from min_x, min_y to
+///   max_x, max_y inclusive, in global cube positions, from deltas a row at a
+///   time. Resident chunks are updated in place and their changed cells marked
+///   for upload.
+void
+set_terrain_deltas(GameState *game_state, int min_x, int min_y, int max_x, int max_y, const float *deltas);
+
+/// Apply the brush once, centred on the global XZ position centre.
+void
+apply_terrain_brush(GameState *game_state, vec2 centre, float target_height);
+
 void
 main_loop(GameState *game_state, vec2  mouse_delta);
 
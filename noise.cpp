@@ -0,0 +1,39 @@
+#include "noise.h"
+#include "lattice.h"
+#include "perlin.h"
+#include "simplex.h"
+
+#include <math.h>
+
+
+GradientTable
+make_gradient_table()
+{
+  GradientTable table;
+  for (int gradient_n = 0;
+       gradient_n < GRADIENT_TABLE_SIZE;
+       ++gradient_n)
+  {
+    float theta = gradient_n * (2.0*M_PI / GRADIENT_TABLE_SIZE);
+    table.x[gradient_n] = cos(theta);
+    table.y[gradient_n] = sin(theta);
+  }
+  return table;
+}
+
+
+const GradientTable GRADIENT_TABLE = make_gradient_table();
+
+
+// Indexed by NoiseBackend
+const NoiseFunctions NOISE_BACKENDS[] = {
+  {perlin, perlin_gradient, perlin_octaves_tile},
+  {simplex, simplex_gradient, simplex_octaves_tile}
+};
+
+
+const NoiseFunctions &
+get_noise_functions(NoiseBackend backend)
+{
+  return NOISE_BACKENDS[(int)backend];
+}
@@ -0,0 +1,37 @@
+#ifndef NOISE_H_DEF
+#define NOISE_H_DEF
+
+#include "ccVector.h"
+
+
+enum struct NoiseBackend
+{
+  Perlin,
+  Simplex
+};
+
+const char NOISE_BACKEND_NAMES[] = "Perlin\0Simplex\0\0";
+
+
+typedef float (*NoiseFunction)(vec2 position, float period);
+
+/// A NoiseFunction also writing its gradient with respect to position.
+typedef float (*NoiseGradientFunction)(vec2 position, float period, vec2 *gradient);
+
+/// Write the sum of n_octaves octaves over a size x size tile into result, and
+///   the sum's gradient into gradients unless it is 0.
+typedef void (*OctavesTileFunction)(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients);
+
+struct NoiseFunctions
+{
+  NoiseFunction sample;
+  NoiseGradientFunction sample_gradient;
+  OctavesTileFunction octaves_tile;
+};
+
+
+const NoiseFunctions &
+get_noise_functions(NoiseBackend backend);
+
+
+#endif
@@ -1,65 +1,852 @@
-#include "random.h"
+#include "perlin.h"
 #include "ccVector.h"
+#include "lattice.h"
 
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 
-vec2
-random_unit_vector(int seed)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+const float PERLIN_TILE_TOLERANCE = 1e-5;
+
+
+float
+fade(float t)
 {
-  float theta = random_0_1_float(seed) * 2.0*M_PI;
-  vec2 result;
-  result.x = cos(theta);
-  result.y = sin(theta);
-  return result;
+  return t * t * (3 - 2*t);
 }
 
 
-int
-hash_vector(vec2 vector)
+float
+fade_derivative(float t)
 {
-  int result = vector.x*2521 + vector.y*7043;
-  return result;
+  return 6 * t * (1 - t);
 }
 
 
+/// One sample of the noise, given the row terms shared by every sample in a tile row.
 float
-lerp(float a, float b, float t)
+perlin_sample(float x, float Sy, uint32_t hash_y0, uint32_t hash_y1, float fractional_y)
 {
-  float result = (t * a) + ((1-t) * b);
-  return result;
+  float integer_x = floorf(x);
+  float fractional_x = x - integer_x;
+
+  uint32_t hash_x0 = (uint32_t)(int)integer_x * LATTICE_HASH_X;
+  uint32_t hash_x1 = hash_x0 + LATTICE_HASH_X;
+
+  int gradient00 = lattice_hash_finalise(hash_x0 ^ hash_y0);
+  int gradient10 = lattice_hash_finalise(hash_x1 ^ hash_y0);
+  int gradient01 = lattice_hash_finalise(hash_x0 ^ hash_y1);
+  int gradient11 = lattice_hash_finalise(hash_x1 ^ hash_y1);
+
+  const GradientTable &table = GRADIENT_TABLE;
+  float s = table.x[gradient00]*fractional_x     + table.y[gradient00]*fractional_y;
+  float t = table.x[gradient10]*(fractional_x-1) + table.y[gradient10]*fractional_y;
+  float u = table.x[gradient01]*fractional_x     + table.y[gradient01]*(fractional_y-1);
+  float v = table.x[gradient11]*(fractional_x-1) + table.y[gradient11]*(fractional_y-1);
+
+  float Sx = fade(fractional_x);
+  float a = s + Sx*(t - s);
+  float b = u + Sx*(v - u);
+
+  return a + Sy*(b - a);
 }
 
 
 float
 perlin(vec2 input, float period)
 {
-  float result;
-
   input = vec2Multiply(input, 1.0/period);
 
-  vec2 integer_coord = {(float)floor(input.x), (float)floor(input.y)};
-  vec2 fractional = vec2Subtract(input, integer_coord);
+  float integer_y = floorf(input.y);
+  float fractional_y = input.y - integer_y;
+
+  uint32_t hash_y0 = (uint32_t)(int)integer_y * LATTICE_HASH_Y;
+  uint32_t hash_y1 = hash_y0 + LATTICE_HASH_Y;
+
+  return perlin_sample(input.x, fade(fractional_y), hash_y0, hash_y1, fractional_y);
+}
+
+
+float
+perlin_gradient(vec2 input, float period, vec2 *gradient)
+{
+  float inv_period = 1.0/period;
+  input = vec2Multiply(input, inv_period);
+
+  float integer_x = floorf(input.x);
+  float integer_y = floorf(input.y);
+  float fx = input.x - integer_x;
+  float fy = input.y - integer_y;
+
+  int x = integer_x;
+  int y = integer_y;
 
-  vec2 p00 = vec2Add(integer_coord, {0, 0});
-  vec2 p10 = vec2Add(integer_coord, {1, 0});
-  vec2 p01 = vec2Add(integer_coord, {0, 1});
-  vec2 p11 = vec2Add(integer_coord, {1, 1});
+  const GradientTable &table = GRADIENT_TABLE;
+  int gradient00 = lattice_hash(x, y);
+  int gradient10 = lattice_hash(x + 1, y);
+  int gradient01 = lattice_hash(x, y + 1);
+  int gradient11 = lattice_hash(x + 1, y + 1);
 
-  vec2 gradient00 = random_unit_vector(hash_vector(p00));
-  vec2 gradient10 = random_unit_vector(hash_vector(p10));
-  vec2 gradient01 = random_unit_vector(hash_vector(p01));
-  vec2 gradient11 = random_unit_vector(hash_vector(p11));
+  float s = table.x[gradient00]*fx     + table.y[gradient00]*fy;
+  float t = table.x[gradient10]*(fx-1) + table.y[gradient10]*fy;
+  float u = table.x[gradient01]*fx     + table.y[gradient01]*(fy-1);
+  float v = table.x[gradient11]*(fx-1) + table.y[gradient11]*(fy-1);
 
-  float s = vec2DotProduct(gradient00, vec2Subtract(input, p00));
-  float t = vec2DotProduct(gradient10, vec2Subtract(input, p10));
-  float u = vec2DotProduct(gradient01, vec2Subtract(input, p01));
-  float v = vec2DotProduct(gradient11, vec2Subtract(input, p11));
+  float Sx = fade(fx);
+  float Sy = fade(fy);
+  float dSx = fade_derivative(fx);
+  float dSy = fade_derivative(fy);
 
-  float Sx = 3.0*pow(fractional.x, 2.0f) - 2.0*pow(fractional.x, 3.0f);
   float a = s + Sx*(t - s);
   float b = u + Sx*(v - u);
 
-  float Sy = 3.0*pow(fractional.y, 2.0f) - 2.0*pow(fractional.y, 3.0f);
-  result = a + Sy*(b - a);
+  // d/dfx and d/dfy of a and b, s, t, u and v being linear in fx and fy
+  float da_dx = table.x[gradient00] + dSx*(t - s) + Sx*(table.x[gradient10] - table.x[gradient00]);
+  float db_dx = table.x[gradient01] + dSx*(v - u) + Sx*(table.x[gradient11] - table.x[gradient01]);
+  float da_dy = table.y[gradient00] + Sx*(table.y[gradient10] - table.y[gradient00]);
+  float db_dy = table.y[gradient01] + Sx*(table.y[gradient11] - table.y[gradient01]);
+
+  gradient->x = (da_dx + Sy*(db_dx - da_dx)) * inv_period;
+  gradient->y = (da_dy + Sy*(db_dy - da_dy) + dSy*(b - a)) * inv_period;
+
+  return a + Sy*(b - a);
+}
+
+
+void
+perlin_tile_reference(vec2 origin, int width, int height, float period, float amplitude, float *result)
+{
+  vec2 translation;
+  for (translation.y = 0;
+       translation.y < height;
+       ++translation.y)
+  for (translation.x = 0;
+       translation.x < width;
+       ++translation.x)
+  {
+    *result++ += amplitude * perlin(vec2Add(origin, translation), period);
+  }
+}
+
+
+// Batch evaluation
+//
+// The row kernels evaluate perlin_sample() for as many whole SIMD registers
+//   of a tile row as fit, and return the first column they did not handle.
+
+#if defined(__AVX2__)
+
+const int PERLIN_LANES = 8;
+
+__m256i
+lattice_hash_finalise(__m256i hash)
+{
+  hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+  hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(LATTICE_HASH_MIX));
+  hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 15));
+  return _mm256_and_si256(hash, _mm256_set1_epi32(GRADIENT_TABLE_SIZE - 1));
+}
+
+
+int
+perlin_row_simd(float *result, float x, int width, float inv_period, float amplitude, float Sy, uint32_t hash_y0, uint32_t hash_y1, float fractional_y)
+{
+  const GradientTable &table = GRADIENT_TABLE;
+
+  __m256 lane_offsets = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 one = _mm256_set1_ps(1);
+  __m256i hash_x_step = _mm256_set1_epi32(LATTICE_HASH_X);
+  __m256i hy0 = _mm256_set1_epi32(hash_y0);
+  __m256i hy1 = _mm256_set1_epi32(hash_y1);
+  __m256 fy0 = _mm256_set1_ps(fractional_y);
+  __m256 fy1 = _mm256_set1_ps(fractional_y - 1);
+  __m256 sy = _mm256_set1_ps(Sy);
+  __m256 amp = _mm256_set1_ps(amplitude);
+
+  int column = 0;
+  for (;
+       column + PERLIN_LANES <= width;
+       column += PERLIN_LANES)
+  {
+    __m256 px = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(x + column), lane_offsets), _mm256_set1_ps(inv_period));
+    __m256 ix = _mm256_floor_ps(px);
+    __m256 fx0 = _mm256_sub_ps(px, ix);
+    __m256 fx1 = _mm256_sub_ps(fx0, one);
+
+    __m256i hx0 = _mm256_mullo_epi32(_mm256_cvtps_epi32(ix), hash_x_step);
+    __m256i hx1 = _mm256_add_epi32(hx0, hash_x_step);
+    __m256i gradient00 = lattice_hash_finalise(_mm256_xor_si256(hx0, hy0));
+    __m256i gradient10 = lattice_hash_finalise(_mm256_xor_si256(hx1, hy0));
+    __m256i gradient01 = lattice_hash_finalise(_mm256_xor_si256(hx0, hy1));
+    __m256i gradient11 = lattice_hash_finalise(_mm256_xor_si256(hx1, hy1));
+
+    __m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(table.x, gradient00, 4), fx0), _mm256_mul_ps(_mm256_i32gather_ps(table.y, gradient00, 4), fy0));
+    __m256 t = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(table.x, gradient10, 4), fx1), _mm256_mul_ps(_mm256_i32gather_ps(table.y, gradient10, 4), fy0));
+    __m256 u = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(table.x, gradient01, 4), fx0), _mm256_mul_ps(_mm256_i32gather_ps(table.y, gradient01, 4), fy1));
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(table.x, gradient11, 4), fx1), _mm256_mul_ps(_mm256_i32gather_ps(table.y, gradient11, 4), fy1));
+
+    // fade(fx) = fx*fx*(3 - 2*fx)
+    __m256 sx = _mm256_mul_ps(_mm256_mul_ps(fx0, fx0), _mm256_sub_ps(_mm256_set1_ps(3), _mm256_add_ps(fx0, fx0)));
+    __m256 a = _mm256_add_ps(s, _mm256_mul_ps(sx, _mm256_sub_ps(t, s)));
+    __m256 b = _mm256_add_ps(u, _mm256_mul_ps(sx, _mm256_sub_ps(v, u)));
+    __m256 r = _mm256_add_ps(a, _mm256_mul_ps(sy, _mm256_sub_ps(b, a)));
+
+    _mm256_storeu_ps(result + column, _mm256_add_ps(_mm256_loadu_ps(result + column), _mm256_mul_ps(amp, r)));
+  }
+  return column;
+}
+
+#elif defined(__SSE2__)
+
+const int PERLIN_LANES = 4;
+
+__m128
+gather(const float *table, __m128i indices)
+{
+  alignas(16) int index[4];
+  _mm_store_si128((__m128i *)index, indices);
+  return _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+}
+
+
+/// 32-bit multiply, SSE2 only has the unsigned 32x32->64 form.
+__m128i
+mullo_epi32(__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+__m128i
+lattice_hash_finalise(__m128i hash)
+{
+  hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+  hash = mullo_epi32(hash, _mm_set1_epi32(LATTICE_HASH_MIX));
+  hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+  return _mm_and_si128(hash, _mm_set1_epi32(GRADIENT_TABLE_SIZE - 1));
+}
+
+
+int
+perlin_row_simd(float *result, float x, int width, float inv_period, float amplitude, float Sy, uint32_t hash_y0, uint32_t hash_y1, float fractional_y)
+{
+  const GradientTable &table = GRADIENT_TABLE;
+
+  __m128 lane_offsets = _mm_setr_ps(0, 1, 2, 3);
+  __m128 one = _mm_set1_ps(1);
+  __m128i hash_x_step = _mm_set1_epi32(LATTICE_HASH_X);
+  __m128i hy0 = _mm_set1_epi32(hash_y0);
+  __m128i hy1 = _mm_set1_epi32(hash_y1);
+  __m128 fy0 = _mm_set1_ps(fractional_y);
+  __m128 fy1 = _mm_set1_ps(fractional_y - 1);
+  __m128 sy = _mm_set1_ps(Sy);
+  __m128 amp = _mm_set1_ps(amplitude);
+
+  int column = 0;
+  for (;
+       column + PERLIN_LANES <= width;
+       column += PERLIN_LANES)
+  {
+    __m128 px = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(x + column), lane_offsets), _mm_set1_ps(inv_period));
+
+    // floor(), SSE2 only truncates towards zero
+    __m128i truncated = _mm_cvttps_epi32(px);
+    __m128 below = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), px);
+    __m128i ix = _mm_add_epi32(truncated, _mm_castps_si128(below));
+    __m128 fx0 = _mm_sub_ps(px, _mm_cvtepi32_ps(ix));
+    __m128 fx1 = _mm_sub_ps(fx0, one);
+
+    __m128i hx0 = mullo_epi32(ix, hash_x_step);
+    __m128i hx1 = _mm_add_epi32(hx0, hash_x_step);
+    __m128i gradient00 = lattice_hash_finalise(_mm_xor_si128(hx0, hy0));
+    __m128i gradient10 = lattice_hash_finalise(_mm_xor_si128(hx1, hy0));
+    __m128i gradient01 = lattice_hash_finalise(_mm_xor_si128(hx0, hy1));
+    __m128i gradient11 = lattice_hash_finalise(_mm_xor_si128(hx1, hy1));
+
+    __m128 s = _mm_add_ps(_mm_mul_ps(gather(table.x, gradient00), fx0), _mm_mul_ps(gather(table.y, gradient00), fy0));
+    __m128 t = _mm_add_ps(_mm_mul_ps(gather(table.x, gradient10), fx1), _mm_mul_ps(gather(table.y, gradient10), fy0));
+    __m128 u = _mm_add_ps(_mm_mul_ps(gather(table.x, gradient01), fx0), _mm_mul_ps(gather(table.y, gradient01), fy1));
+    __m128 v = _mm_add_ps(_mm_mul_ps(gather(table.x, gradient11), fx1), _mm_mul_ps(gather(table.y, gradient11), fy1));
+
+    // fade(fx) = fx*fx*(3 - 2*fx)
+    __m128 sx = _mm_mul_ps(_mm_mul_ps(fx0, fx0), _mm_sub_ps(_mm_set1_ps(3), _mm_add_ps(fx0, fx0)));
+    __m128 a = _mm_add_ps(s, _mm_mul_ps(sx, _mm_sub_ps(t, s)));
+    __m128 b = _mm_add_ps(u, _mm_mul_ps(sx, _mm_sub_ps(v, u)));
+    __m128 r = _mm_add_ps(a, _mm_mul_ps(sy, _mm_sub_ps(b, a)));
+
+    _mm_storeu_ps(result + column, _mm_add_ps(_mm_loadu_ps(result + column), _mm_mul_ps(amp, r)));
+  }
+  return column;
+}
+
+#else
+
+int
+perlin_row_simd(float *result, float x, int width, float inv_period, float amplitude, float Sy, uint32_t hash_y0, uint32_t hash_y1, float fractional_y)
+{
+  return 0;
+}
+
+#endif
+
+
+// Cell-coherent evaluation
+//
+// Once the period is a few samples wide, neighbouring samples share a lattice
+//   cell. Within one cell, a row of noise is
+//
+//     P*fx + Q + fade(fx)*(R*fx + T)
+//
+//   where P, Q, R and T depend only on the cell's corner gradients and the row.
+//   So gradients are resolved once per cell, P, Q, R and T once per row of a
+//   cell, and each sample is three multiply-adds on per-column fx and fade(fx).
+
+const float PERLIN_CELL_MIN_PERIOD = 4;
+const int PERLIN_CELL_MAX_WIDTH = 64;
+
+struct CellGradients
+{
+  float x00, y00;
+  float x10, y10;
+  float x01, y01;
+  float x11, y11;
+};
+
+
+void
+perlin_tile_cells(vec2 origin, int width, int height, float inv_period, float amplitude, float *result)
+{
+  assert(width <= PERLIN_CELL_MAX_WIDTH);
+
+  const GradientTable &table = GRADIENT_TABLE;
+
+  float fractional_x[PERLIN_CELL_MAX_WIDTH];
+  float fade_x[PERLIN_CELL_MAX_WIDTH];
+
+  // Columns [run_starts[n], run_starts[n+1]) fall in the same lattice column
+  int run_starts[PERLIN_CELL_MAX_WIDTH + 1];
+  uint32_t run_hash_x0s[PERLIN_CELL_MAX_WIDTH];
+  int n_runs = 0;
+
+  float previous_integer_x = 0;
+  for (int column = 0;
+       column < width;
+       ++column)
+  {
+    float x = (origin.x + column) * inv_period;
+    float integer_x = floorf(x);
+    fractional_x[column] = x - integer_x;
+    fade_x[column] = fade(fractional_x[column]);
+
+    if (column == 0 || integer_x != previous_integer_x)
+    {
+      run_starts[n_runs] = column;
+      run_hash_x0s[n_runs] = (uint32_t)(int)integer_x * LATTICE_HASH_X;
+      ++n_runs;
+      previous_integer_x = integer_x;
+    }
+  }
+  run_starts[n_runs] = width;
 
-  return result;
-}
\ No newline at end of file
+  CellGradients gradients[PERLIN_CELL_MAX_WIDTH];
+
+  float previous_integer_y = 0;
+  for (int row = 0;
+       row < height;
+       ++row)
+  {
+    float y = (origin.y + row) * inv_period;
+    float integer_y = floorf(y);
+    float fy0 = y - integer_y;
+    float fy1 = fy0 - 1;
+    float Sy = fade(fy0);
+
+    // Entered a new row of cells
+    if (row == 0 || integer_y != previous_integer_y)
+    {
+      uint32_t hash_y0 = (uint32_t)(int)integer_y * LATTICE_HASH_Y;
+      uint32_t hash_y1 = hash_y0 + LATTICE_HASH_Y;
+
+      for (int run_n = 0;
+           run_n < n_runs;
+           ++run_n)
+      {
+        uint32_t hash_x0 = run_hash_x0s[run_n];
+        uint32_t hash_x1 = hash_x0 + LATTICE_HASH_X;
+
+        int gradient00 = lattice_hash_finalise(hash_x0 ^ hash_y0);
+        int gradient10 = lattice_hash_finalise(hash_x1 ^ hash_y0);
+        int gradient01 = lattice_hash_finalise(hash_x0 ^ hash_y1);
+        int gradient11 = lattice_hash_finalise(hash_x1 ^ hash_y1);
+
+        gradients[run_n] = {table.x[gradient00], table.y[gradient00],
+                            table.x[gradient10], table.y[gradient10],
+                            table.x[gradient01], table.y[gradient01],
+                            table.x[gradient11], table.y[gradient11]};
+      }
+
+      previous_integer_y = integer_y;
+    }
+
+    float *result_row = result + row*width;
+
+    for (int run_n = 0;
+         run_n < n_runs;
+         ++run_n)
+    {
+      const CellGradients &g = gradients[run_n];
+
+      // perlin_sample() is a + Sy*(b - a) = (s + Sy*(u - s)) + Sx*((t - s) + Sy*((v - u) - (t - s))),
+      //   with s, t, u and v each linear in fx.
+      float ts_x = g.x10 - g.x00;
+      float ts_c = g.y10*fy0 - g.x10 - g.y00*fy0;
+      float vu_x = g.x11 - g.x01;
+      float vu_c = g.y11*fy1 - g.x11 - g.y01*fy1;
+
+      float P = amplitude * (g.x00 + Sy*(g.x01 - g.x00));
+      float Q = amplitude * (g.y00*fy0 + Sy*(g.y01*fy1 - g.y00*fy0));
+      float R = amplitude * (ts_x + Sy*(vu_x - ts_x));
+      float T = amplitude * (ts_c + Sy*(vu_c - ts_c));
+
+      for (int column = run_starts[run_n];
+           column < run_starts[run_n + 1];
+           ++column)
+      {
+        float fx = fractional_x[column];
+        result_row[column] += P*fx + Q + fade_x[column]*(R*fx + T);
+      }
+    }
+  }
+}
+
+
+void
+perlin_tile_rows(vec2 origin, int width, int height, float period, float amplitude, float *result)
+{
+  float inv_period = 1.0/period;
+
+  for (int row = 0;
+       row < height;
+       ++row)
+  {
+    float y = (origin.y + row) * inv_period;
+    float integer_y = floorf(y);
+    float fractional_y = y - integer_y;
+    float Sy = fade(fractional_y);
+
+    uint32_t hash_y0 = (uint32_t)(int)integer_y * LATTICE_HASH_Y;
+    uint32_t hash_y1 = hash_y0 + LATTICE_HASH_Y;
+
+    float *result_row = result + row*width;
+
+    int column = perlin_row_simd(result_row, origin.x, width, inv_period, amplitude, Sy, hash_y0, hash_y1, fractional_y);
+    for (;
+         column < width;
+         ++column)
+    {
+      result_row[column] += amplitude * perlin_sample((origin.x + column) * inv_period, Sy, hash_y0, hash_y1, fractional_y);
+    }
+  }
+}
+
+
+void
+perlin_tile(vec2 origin, int width, int height, float period, float amplitude, float *result)
+{
+#ifdef _DEBUG
+  float *reference = (float *)malloc(width * height * sizeof(float));
+  for (int sample_n = 0; sample_n < width * height; ++sample_n)
+  {
+    reference[sample_n] = result[sample_n];
+  }
+  perlin_tile_reference(origin, width, height, period, amplitude, reference);
+#endif
+
+  // Short periods have too few samples per cell to be worth walking cells
+  if (period >= PERLIN_CELL_MIN_PERIOD && width <= PERLIN_CELL_MAX_WIDTH)
+  {
+    perlin_tile_cells(origin, width, height, 1.0/period, amplitude, result);
+  }
+  else
+  {
+    perlin_tile_rows(origin, width, height, period, amplitude, result);
+  }
+
+#ifdef _DEBUG
+  for (int sample_n = 0; sample_n < width * height; ++sample_n)
+  {
+    assert(fabs(result[sample_n] - reference[sample_n]) <= PERLIN_TILE_TOLERANCE * fmax(1, fabs(amplitude)));
+  }
+  free(reference);
+#endif
+}
+
+
+// Specialised kernels
+//
+// The tile size and octave count are template parameters, so each row is one
+//   fixed-length loop over columns the compiler can unroll and vectorise, with
+//   every octave summed in registers before the sample is stored once.
+//
+// Expanding perlin_sample() in fy for a fixed column of a fixed cell gives
+//
+//     C0 + D0*fy + Sy*(C1 + D1*fy)
+//
+//   so each octave keeps C0, D0, C1 and D1 per column, refreshed only when a
+//   row enters a new row of cells, and a sample costs three multiply-adds per
+//   octave. The gradient instances also keep E0, F0, E1 and F1, the same
+//   expansion of d/dfx, and get d/dfy from D0, D1 and fade_derivative(fy).
+
+template <int TILE_SIZE>
+struct OctaveColumns
+{
+  float inv_period;
+  float amplitude;
+
+  float fractional_x[TILE_SIZE];
+  float fade_x[TILE_SIZE];
+  uint32_t hash_x0s[TILE_SIZE];
+
+  // The row of cells the coefficients are for
+  float integer_y;
+  float C0[TILE_SIZE];
+  float D0[TILE_SIZE];
+  float C1[TILE_SIZE];
+  float D1[TILE_SIZE];
+
+  // Scaled to world units, only kept by the gradient instances
+  float E0[TILE_SIZE];
+  float F0[TILE_SIZE];
+  float E1[TILE_SIZE];
+  float F1[TILE_SIZE];
+};
+
+
+template <int TILE_SIZE>
+void
+init_octave_columns(OctaveColumns<TILE_SIZE> *octave, float origin_x, float period, float amplitude)
+{
+  octave->inv_period = 1.0f/period;
+  octave->amplitude = amplitude;
+
+  for (int column = 0;
+       column < TILE_SIZE;
+       ++column)
+  {
+    float x = (origin_x + column) * octave->inv_period;
+    float integer_x = floor_fast(x);
+    octave->fractional_x[column] = x - integer_x;
+    octave->fade_x[column] = fade(octave->fractional_x[column]);
+    octave->hash_x0s[column] = (uint32_t)(int)integer_x * LATTICE_HASH_X;
+  }
+}
+
+
+template <int TILE_SIZE, bool GRADIENTS>
+void
+update_octave_coefficients(OctaveColumns<TILE_SIZE> *octave, float integer_y)
+{
+  const GradientTable &table = GRADIENT_TABLE;
+
+  uint32_t hash_y0 = (uint32_t)(int)integer_y * LATTICE_HASH_Y;
+  uint32_t hash_y1 = hash_y0 + LATTICE_HASH_Y;
+
+  CellGradients g = {};
+  for (int column = 0;
+       column < TILE_SIZE;
+       ++column)
+  {
+    // Resolve each cell once, its other columns reuse it
+    if (column == 0 || octave->hash_x0s[column] != octave->hash_x0s[column - 1])
+    {
+      uint32_t hash_x0 = octave->hash_x0s[column];
+      uint32_t hash_x1 = hash_x0 + LATTICE_HASH_X;
+
+      int gradient00 = lattice_hash_finalise(hash_x0 ^ hash_y0);
+      int gradient10 = lattice_hash_finalise(hash_x1 ^ hash_y0);
+      int gradient01 = lattice_hash_finalise(hash_x0 ^ hash_y1);
+      int gradient11 = lattice_hash_finalise(hash_x1 ^ hash_y1);
+
+      g = {table.x[gradient00], table.y[gradient00],
+           table.x[gradient10], table.y[gradient10],
+           table.x[gradient01], table.y[gradient01],
+           table.x[gradient11], table.y[gradient11]};
+    }
+
+    float fx = octave->fractional_x[column];
+    float Sx = octave->fade_x[column];
+
+    // a = s + Sx*(t - s) = A0 + A1*fy and b = u + Sx*(v - u) = B0 + B1*fy
+    float s0 = g.x00*fx;
+    float t0 = g.x10*(fx - 1);
+    float u0 = g.x01*fx - g.y01;
+    float v0 = g.x11*(fx - 1) - g.y11;
+
+    float A0 = s0 + Sx*(t0 - s0);
+    float A1 = g.y00 + Sx*(g.y10 - g.y00);
+    float B0 = u0 + Sx*(v0 - u0);
+    float B1 = g.y01 + Sx*(g.y11 - g.y01);
+
+    octave->C0[column] = octave->amplitude * A0;
+    octave->D0[column] = octave->amplitude * A1;
+    octave->C1[column] = octave->amplitude * (B0 - A0);
+    octave->D1[column] = octave->amplitude * (B1 - A1);
+
+    if (GRADIENTS)
+    {
+      float dSx = fade_derivative(fx);
+      float dA0 = g.x00 + dSx*(t0 - s0) + Sx*(g.x10 - g.x00);
+      float dA1 = dSx*(g.y10 - g.y00);
+      float dB0 = g.x01 + dSx*(v0 - u0) + Sx*(g.x11 - g.x01);
+      float dB1 = dSx*(g.y11 - g.y01);
+
+      float scale = octave->amplitude * octave->inv_period;
+      octave->E0[column] = scale * dA0;
+      octave->F0[column] = scale * dA1;
+      octave->E1[column] = scale * (dB0 - dA0);
+      octave->F1[column] = scale * (dB1 - dA1);
+    }
+  }
+
+  octave->integer_y = integer_y;
+}
+
+
+template <int TILE_SIZE, int N_OCTAVES, bool GRADIENTS>
+void
+perlin_octaves_tile_fixed(vec2 origin, const int *periods, const float *amplitudes, float *result, vec2 *gradients)
+{
+  OctaveColumns<TILE_SIZE> octaves[N_OCTAVES];
+
+  for (int octave_n = 0;
+       octave_n < N_OCTAVES;
+       ++octave_n)
+  {
+    init_octave_columns(octaves + octave_n, origin.x, periods[octave_n], amplitudes[octave_n]);
+  }
+
+  for (int row = 0;
+       row < TILE_SIZE;
+       ++row)
+  {
+    float fy[N_OCTAVES];
+    float Sy[N_OCTAVES];
+    float dSy[N_OCTAVES];
+
+    for (int octave_n = 0;
+         octave_n < N_OCTAVES;
+         ++octave_n)
+    {
+      OctaveColumns<TILE_SIZE> *octave = octaves + octave_n;
+
+      float y = (origin.y + row) * octave->inv_period;
+      float integer_y = floor_fast(y);
+      fy[octave_n] = y - integer_y;
+      Sy[octave_n] = fade(fy[octave_n]);
+      dSy[octave_n] = fade_derivative(fy[octave_n]) * octave->inv_period;
+
+      if (row == 0 || integer_y != octave->integer_y)
+      {
+        update_octave_coefficients<TILE_SIZE, GRADIENTS>(octave, integer_y);
+      }
+    }
+
+    float *result_row = result + row*TILE_SIZE;
+
+    for (int column = 0;
+         column < TILE_SIZE;
+         ++column)
+    {
+      float sample = 0;
+      for (int octave_n = 0;
+           octave_n < N_OCTAVES;
+           ++octave_n)
+      {
+        const OctaveColumns<TILE_SIZE> &octave = octaves[octave_n];
+        sample += octave.C0[column] + octave.D0[column]*fy[octave_n] +
+                  Sy[octave_n]*(octave.C1[column] + octave.D1[column]*fy[octave_n]);
+      }
+      result_row[column] = sample;
+    }
+
+    if (GRADIENTS)
+    {
+      vec2 *gradients_row = gradients + row*TILE_SIZE;
+
+      for (int column = 0;
+           column < TILE_SIZE;
+           ++column)
+      {
+        vec2 gradient = {};
+        for (int octave_n = 0;
+             octave_n < N_OCTAVES;
+             ++octave_n)
+        {
+          const OctaveColumns<TILE_SIZE> &octave = octaves[octave_n];
+          float f = fy[octave_n];
+          gradient.x += octave.E0[column] + octave.F0[column]*f + Sy[octave_n]*(octave.E1[column] + octave.F1[column]*f);
+          gradient.y += octave.inv_period*(octave.D0[column] + Sy[octave_n]*octave.D1[column]) +
+                        dSy[octave_n]*(octave.C1[column] + octave.D1[column]*f);
+        }
+        gradients_row[column] = gradient;
+      }
+    }
+  }
+}
+
+
+typedef void (*OctavesTileKernel)(vec2 origin, const int *periods, const float *amplitudes, float *result, vec2 *gradients);
+
+// Instances for the octave counts the planner usually leaves, by n_octaves - 1
+const int PERLIN_FIXED_MAX_OCTAVES = 4;
+
+const OctavesTileKernel PERLIN_OCTAVES_TILE_16[PERLIN_FIXED_MAX_OCTAVES] = {
+  perlin_octaves_tile_fixed<16, 1, false>,
+  perlin_octaves_tile_fixed<16, 2, false>,
+  perlin_octaves_tile_fixed<16, 3, false>,
+  perlin_octaves_tile_fixed<16, 4, false>
+};
+
+const OctavesTileKernel PERLIN_OCTAVES_TILE_32[PERLIN_FIXED_MAX_OCTAVES] = {
+  perlin_octaves_tile_fixed<32, 1, false>,
+  perlin_octaves_tile_fixed<32, 2, false>,
+  perlin_octaves_tile_fixed<32, 3, false>,
+  perlin_octaves_tile_fixed<32, 4, false>
+};
+
+const OctavesTileKernel PERLIN_OCTAVES_GRADIENTS_TILE_16[PERLIN_FIXED_MAX_OCTAVES] = {
+  perlin_octaves_tile_fixed<16, 1, true>,
+  perlin_octaves_tile_fixed<16, 2, true>,
+  perlin_octaves_tile_fixed<16, 3, true>,
+  perlin_octaves_tile_fixed<16, 4, true>
+};
+
+const OctavesTileKernel PERLIN_OCTAVES_GRADIENTS_TILE_32[PERLIN_FIXED_MAX_OCTAVES] = {
+  perlin_octaves_tile_fixed<32, 1, true>,
+  perlin_octaves_tile_fixed<32, 2, true>,
+  perlin_octaves_tile_fixed<32, 3, true>,
+  perlin_octaves_tile_fixed<32, 4, true>
+};
+
+
+void
+perlin_octaves_tile_generic(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients)
+{
+  for (int sample_n = 0;
+       sample_n < size*size;
+       ++sample_n)
+  {
+    result[sample_n] = 0;
+  }
+
+  for (int octave_n = 0;
+       octave_n < n_octaves;
+       ++octave_n)
+  {
+    perlin_tile(origin, size, size, periods[octave_n], amplitudes[octave_n], result);
+  }
+
+  if (gradients)
+  {
+    for (int sample_n = 0;
+         sample_n < size*size;
+         ++sample_n)
+    {
+      vec2 position = {origin.x + sample_n % size, origin.y + sample_n / size};
+
+      gradients[sample_n] = {};
+      for (int octave_n = 0;
+           octave_n < n_octaves;
+           ++octave_n)
+      {
+        vec2 gradient;
+        perlin_gradient(position, periods[octave_n], &gradient);
+        gradients[sample_n] = vec2Add(gradients[sample_n], vec2Multiply(gradient, amplitudes[octave_n]));
+      }
+    }
+  }
+}
+
+
+/// Pick the specialised kernel for the tile size and octave count, if there is
+///   one and every octave is long enough to walk by cells.
+OctavesTileKernel
+get_octaves_tile_kernel(int size, int n_octaves, const int *periods, bool gradients)
+{
+  if (n_octaves < 1 || n_octaves > PERLIN_FIXED_MAX_OCTAVES)
+  {
+    return 0;
+  }
+
+  for (int octave_n = 0;
+       octave_n < n_octaves;
+       ++octave_n)
+  {
+    if (periods[octave_n] < PERLIN_CELL_MIN_PERIOD)
+    {
+      return 0;
+    }
+  }
+
+  switch (size)
+  {
+    case 16: return (gradients ? PERLIN_OCTAVES_GRADIENTS_TILE_16 : PERLIN_OCTAVES_TILE_16)[n_octaves - 1];
+    case 32: return (gradients ? PERLIN_OCTAVES_GRADIENTS_TILE_32 : PERLIN_OCTAVES_TILE_32)[n_octaves - 1];
+    default: return 0;
+  }
+}
+
+
+void
+perlin_octaves_tile(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients)
+{
+  OctavesTileKernel kernel = get_octaves_tile_kernel(size, n_octaves, periods, gradients != 0);
+  if (!kernel)
+  {
+    perlin_octaves_tile_generic(origin, size, n_octaves, periods, amplitudes, result, gradients);
+    return;
+  }
+
+  kernel(origin, periods, amplitudes, result, gradients);
+
+#ifdef _DEBUG
+  float *reference = (float *)calloc(size * size, sizeof(float));
+  float total_amplitude = 0;
+  for (int octave_n = 0; octave_n < n_octaves; ++octave_n)
+  {
+    perlin_tile_reference(origin, size, size, periods[octave_n], amplitudes[octave_n], reference);
+    total_amplitude += fabs(amplitudes[octave_n]);
+  }
+  for (int sample_n = 0; sample_n < size * size; ++sample_n)
+  {
+    assert(fabs(result[sample_n] - reference[sample_n]) <= PERLIN_TILE_TOLERANCE * fmax(1, total_amplitude));
+  }
+  free(reference);
+
+  if (gradients)
+  {
+    for (int sample_n = 0; sample_n < size * size; ++sample_n)
+    {
+      vec2 position = {origin.x + sample_n % size, origin.y + sample_n / size};
+      vec2 reference_gradient = {};
+      for (int octave_n = 0; octave_n < n_octaves; ++octave_n)
+      {
+        vec2 gradient;
+        perlin_gradient(position, periods[octave_n], &gradient);
+        reference_gradient = vec2Add(reference_gradient, vec2Multiply(gradient, amplitudes[octave_n]));
+      }
+      assert(fabs(gradients[sample_n].x - reference_gradient.x) <= PERLIN_TILE_TOLERANCE * fmax(1, total_amplitude));
+      assert(fabs(gradients[sample_n].y - reference_gradient.y) <= PERLIN_TILE_TOLERANCE * fmax(1, total_amplitude));
+    }
+  }
+#endif
+}
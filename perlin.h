@@ -1,5 +1,41 @@
+#ifndef PERLIN_H_DEF
+#define PERLIN_H_DEF
+
 #include "ccVector.h"
 
 
 float
-perlin(vec2 position, float period);
\ No newline at end of file
+perlin(vec2 position, float period);
+
+/// perlin(), also writing its gradient with respect to position.
+float
+perlin_gradient(vec2 position, float period, vec2 *gradient);
+
+/// Accumulate amplitude * perlin() for every sample of a width x height tile
+///   starting at origin into result, laid out as result[y*width + x].
+void
+perlin_tile(vec2 origin, int width, int height, float period, float amplitude, float *result);
+
+/// perlin_tile() evaluated a SIMD row at a time, which it falls back to for
+///   short periods.
+void
+perlin_tile_rows(vec2 origin, int width, int height, float period, float amplitude, float *result);
+
+/// Write the sum of n_octaves octaves over a size x size tile into result, and
+///   the sum's gradient into gradients unless it is 0. Uses a kernel
+///   specialised for the tile size and octave count when there is one,
+///   otherwise perlin_octaves_tile_generic().
+void
+perlin_octaves_tile(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients = 0);
+
+/// perlin_octaves_tile() as one perlin_tile() per octave, and one
+///   perlin_gradient() per octave and sample for gradients.
+void
+perlin_octaves_tile_generic(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients = 0);
+
+/// Scalar reference for perlin_tile(), built directly on perlin().
+void
+perlin_tile_reference(vec2 origin, int width, int height, float period, float amplitude, float *result);
+
+
+#endif
@@ -73,7 +73,8 @@ static const int RANDOM_0_255_INT[] = {
 int
 random_0_255_int(int seed)
 {
-  seed = seed % RANDOM_0_255_INT_SIZE;
+  // Wrap negative seeds into the table as well
+  seed = seed & (RANDOM_0_255_INT_SIZE - 1);
 
   int result = RANDOM_0_255_INT[seed];
 
@@ -0,0 +1,157 @@
+#include "simplex.h"
+#include "lattice.h"
+
+
+// Skew from the square lattice to the triangular one and back
+const float SIMPLEX_SKEW = 0.366025403784f;   // (sqrt(3) - 1) / 2
+const float SIMPLEX_UNSKEW = 0.211324865405f; // (3 - sqrt(3)) / 6
+
+// Brings the summed corner contributions to roughly [-1, 1]
+const float SIMPLEX_SCALE = 99.2;
+
+
+/// A corner's contribution, falling off as (r^2 - d^2)^4 with r^2 = 0.5.
+///   Adds the contribution's gradient, t^4*g - 8*t^3*(g.d)*d, to gradient.
+float
+simplex_corner(uint32_t hash, float dx, float dy, vec2 *gradient)
+{
+  // Clamped rather than branched on, which of the corners reach a sample is
+  //   unpredictable
+  float t = 0.5f - dx*dx - dy*dy;
+  t = t > 0 ? t : 0;
+
+  int gradient_n = lattice_hash_finalise(hash);
+  float gx = GRADIENT_TABLE.x[gradient_n];
+  float gy = GRADIENT_TABLE.y[gradient_n];
+  float g_dot_d = gx*dx + gy*dy;
+
+  float t2 = t * t;
+  float t4 = t2 * t2;
+
+  if (gradient)
+  {
+    float falloff = 8 * t2 * t * g_dot_d;
+    gradient->x += t4*gx - falloff*dx;
+    gradient->y += t4*gy - falloff*dy;
+  }
+
+  return t4 * g_dot_d;
+}
+
+
+/// Noise at (x, y) in lattice units, adding its gradient to gradient unless it
+///   is 0.
+float
+simplex_sample(float x, float y, vec2 *gradient)
+{
+  float skew = (x + y) * SIMPLEX_SKEW;
+  float integer_x = floor_fast(x + skew);
+  float integer_y = floor_fast(y + skew);
+
+  float unskew = (integer_x + integer_y) * SIMPLEX_UNSKEW;
+  float x0 = x - (integer_x - unskew);
+  float y0 = y - (integer_y - unskew);
+
+  // Which of the cell's two triangles the sample is in
+  int step_x = x0 > y0 ? 1 : 0;
+  int step_y = 1 - step_x;
+
+  float x1 = x0 - step_x + SIMPLEX_UNSKEW;
+  float y1 = y0 - step_y + SIMPLEX_UNSKEW;
+  float x2 = x0 - 1 + 2*SIMPLEX_UNSKEW;
+  float y2 = y0 - 1 + 2*SIMPLEX_UNSKEW;
+
+  // lattice_hash() of each corner, sharing the multiplies
+  uint32_t hash_x = (uint32_t)(int)integer_x * LATTICE_HASH_X;
+  uint32_t hash_y = (uint32_t)(int)integer_y * LATTICE_HASH_Y;
+  uint32_t hash_step_x = step_x ? LATTICE_HASH_X : 0;
+  uint32_t hash_step_y = step_y ? LATTICE_HASH_Y : 0;
+
+  vec2 corners_gradient = {};
+  vec2 *corners_gradient_out = gradient ? &corners_gradient : 0;
+
+  float n = simplex_corner(hash_x ^ hash_y, x0, y0, corners_gradient_out) +
+            simplex_corner((hash_x + hash_step_x) ^ (hash_y + hash_step_y), x1, y1, corners_gradient_out) +
+            simplex_corner((hash_x + LATTICE_HASH_X) ^ (hash_y + LATTICE_HASH_Y), x2, y2, corners_gradient_out);
+
+  if (gradient)
+  {
+    *gradient = vec2Add(*gradient, vec2Multiply(corners_gradient, SIMPLEX_SCALE));
+  }
+
+  return SIMPLEX_SCALE * n;
+}
+
+
+float
+simplex(vec2 position, float period)
+{
+  float inv_period = 1.0/period;
+  return simplex_sample(position.x * inv_period, position.y * inv_period, 0);
+}
+
+
+float
+simplex_gradient(vec2 position, float period, vec2 *gradient)
+{
+  float inv_period = 1.0/period;
+
+  *gradient = {};
+  float result = simplex_sample(position.x * inv_period, position.y * inv_period, gradient);
+  *gradient = vec2Multiply(*gradient, inv_period);
+
+  return result;
+}
+
+
+void
+simplex_tile(vec2 origin, int width, int height, float period, float amplitude, float *result, vec2 *gradients)
+{
+  float inv_period = 1.0/period;
+
+  for (int row = 0;
+       row < height;
+       ++row)
+  {
+    float y = (origin.y + row) * inv_period;
+    for (int column = 0;
+         column < width;
+         ++column)
+    {
+      if (gradients)
+      {
+        vec2 gradient = {};
+        *result++ += amplitude * simplex_sample((origin.x + column) * inv_period, y, &gradient);
+        *gradients = vec2Add(*gradients, vec2Multiply(gradient, amplitude * inv_period));
+        ++gradients;
+      }
+      else
+      {
+        *result++ += amplitude * simplex_sample((origin.x + column) * inv_period, y, 0);
+      }
+    }
+  }
+}
+
+
+void
+simplex_octaves_tile(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients)
+{
+  for (int sample_n = 0;
+       sample_n < size*size;
+       ++sample_n)
+  {
+    result[sample_n] = 0;
+    if (gradients)
+    {
+      gradients[sample_n] = {};
+    }
+  }
+
+  for (int octave_n = 0;
+       octave_n < n_octaves;
+       ++octave_n)
+  {
+    simplex_tile(origin, size, size, periods[octave_n], amplitudes[octave_n], result, gradients);
+  }
+}
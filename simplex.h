@@ -0,0 +1,28 @@
+#ifndef SIMPLEX_H_DEF
+#define SIMPLEX_H_DEF
+
+#include "ccVector.h"
+
+
+/// 2D simplex noise: three corner contributions on a triangular lattice, in
+///   roughly [-1, 1].
+float
+simplex(vec2 position, float period);
+
+/// simplex(), also writing its gradient with respect to position.
+float
+simplex_gradient(vec2 position, float period, vec2 *gradient);
+
+/// Accumulate amplitude * simplex() for every sample of a width x height tile
+///   starting at origin into result, laid out as result[y*width + x], and its
+///   gradient into gradients unless it is 0.
+void
+simplex_tile(vec2 origin, int width, int height, float period, float amplitude, float *result, vec2 *gradients = 0);
+
+/// Write the sum of n_octaves octaves over a size x size tile into result, and
+///   the sum's gradient into gradients unless it is 0.
+void
+simplex_octaves_tile(vec2 origin, int size, int n_octaves, const int *periods, const float *amplitudes, float *result, vec2 *gradients = 0);
+
+
+#endif
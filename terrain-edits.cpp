@@ -0,0 +1,177 @@
+#include "terrain-edits.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Grow once more than half the slots are occupied, as the chunk table does
+const float TERRAIN_EDITS_MAX_LOAD = 0.5;
+
+
+/// Find the slot holding position's edits, or the empty slot ending its probe
+///   chain.
+int
+probe_edits(TerrainEdits *edits, vec2 position)
+{
+  int slot_n = chunk_position_hash(position) & (edits->capacity - 1);
+  while (edits->slots[slot_n] && !vec2Equal(edits->slots[slot_n]->position, position))
+  {
+    slot_n = (slot_n + 1) & (edits->capacity - 1);
+  }
+  return slot_n;
+}
+
+
+void
+grow_edits(TerrainEdits *edits)
+{
+  ChunkEdits **old_slots = edits->slots;
+  int old_capacity = edits->capacity;
+
+  edits->capacity *= 2;
+  edits->slots = (ChunkEdits **)calloc(edits->capacity, sizeof(ChunkEdits *));
+
+  for (int slot_n = 0;
+       slot_n < old_capacity;
+       ++slot_n)
+  {
+    if (old_slots[slot_n])
+    {
+      edits->slots[probe_edits(edits, old_slots[slot_n]->position)] = old_slots[slot_n];
+    }
+  }
+
+  free(old_slots);
+}
+
+
+void
+terrain_edits_init(TerrainEdits *edits, int capacity)
+{
+  assert((capacity & (capacity - 1)) == 0);
+
+  edits->slots = (ChunkEdits **)calloc(capacity, sizeof(ChunkEdits *));
+  edits->capacity = capacity;
+  edits->n_chunks = 0;
+}
+
+
+void
+terrain_edits_free(TerrainEdits *edits)
+{
+  terrain_edits_clear(edits);
+
+  free(edits->slots);
+  edits->slots = 0;
+  edits->capacity = 0;
+}
+
+
+void
+terrain_edits_clear(TerrainEdits *edits)
+{
+  for (int slot_n = 0;
+       slot_n < edits->capacity;
+       ++slot_n)
+  {
+    free(edits->slots[slot_n]);
+    edits->slots[slot_n] = 0;
+  }
+  edits->n_chunks = 0;
+}
+
+
+ChunkEdits *
+terrain_edits_find(TerrainEdits *edits, vec2 position)
+{
+  return edits->slots[probe_edits(edits, position)];
+}
+
+
+ChunkEdits *
+terrain_edits_get(TerrainEdits *edits, vec2 position)
+{
+  int slot_n = probe_edits(edits, position);
+  if (!edits->slots[slot_n])
+  {
+    if (edits->n_chunks + 1 > edits->capacity * TERRAIN_EDITS_MAX_LOAD)
+    {
+      grow_edits(edits);
+      slot_n = probe_edits(edits, position);
+    }
+
+    edits->slots[slot_n] = (ChunkEdits *)calloc(1, sizeof(ChunkEdits));
+    edits->slots[slot_n]->position = position;
+    edits->n_chunks++;
+  }
+
+  return edits->slots[slot_n];
+}
+
+
+bool
+get_chunk_edit_maps(TerrainEdits *edits, vec2 position, float *height_map, vec2 *slope_map)
+{
+  if (edits->n_chunks == 0)
+  {
+    return false;
+  }
+
+  // The deltas of the chunk with a border of its neighbours', for the slopes'
+  //   central differences. Corners are never read.
+  const int padded_size = CHUNK_SIZE + 2;
+  float deltas[padded_size * padded_size] = {};
+
+  const ChunkEdits *chunk_edits = terrain_edits_find(edits, position);
+  const ChunkEdits *left = terrain_edits_find(edits, vec2Add(position, {-1, 0}));
+  const ChunkEdits *right = terrain_edits_find(edits, vec2Add(position, {1, 0}));
+  const ChunkEdits *below = terrain_edits_find(edits, vec2Add(position, {0, -1}));
+  const ChunkEdits *above = terrain_edits_find(edits, vec2Add(position, {0, 1}));
+  if (!chunk_edits && !left && !right && !below && !above)
+  {
+    return false;
+  }
+
+  for (int n = 0;
+       n < CHUNK_SIZE;
+       ++n)
+  {
+    if (chunk_edits)
+    {
+      memcpy(deltas + (n + 1)*padded_size + 1, chunk_edits->height_deltas + n*CHUNK_SIZE, CHUNK_SIZE * sizeof(float));
+    }
+    if (left)
+    {
+      deltas[(n + 1)*padded_size] = left->height_deltas[n*CHUNK_SIZE + CHUNK_SIZE - 1];
+    }
+    if (right)
+    {
+      deltas[(n + 1)*padded_size + padded_size - 1] = right->height_deltas[n*CHUNK_SIZE];
+    }
+    if (below)
+    {
+      deltas[n + 1] = below->height_deltas[(CHUNK_SIZE - 1)*CHUNK_SIZE + n];
+    }
+    if (above)
+    {
+      deltas[(padded_size - 1)*padded_size + n + 1] = above->height_deltas[n];
+    }
+  }
+
+  for (int y = 0;
+       y < CHUNK_SIZE;
+       ++y)
+  for (int x = 0;
+       x < CHUNK_SIZE;
+       ++x)
+  {
+    const float *delta = deltas + (y + 1)*padded_size + x + 1;
+    height_map[y*CHUNK_SIZE + x] = *delta;
+    slope_map[y*CHUNK_SIZE + x] = {0.5f * (delta[1] - delta[-1]),
+                                   0.5f * (delta[padded_size] - delta[-padded_size])};
+  }
+
+  build_chunk_lods(0, height_map, slope_map);
+  return true;
+}
@@ -0,0 +1,62 @@
+#ifndef TERRAIN_EDITS_H_DEF
+#define TERRAIN_EDITS_H_DEF
+
+#include "chunk-table.h"
+
+
+// Terrain edits
+//
+// Brushes edit the terrain by adding deltas to the heights it is generated
+//   with. The deltas are kept per chunk in a TerrainEdits, apart from the chunk
+//   stores, so that they outlive the chunks they were made on being evicted or
+//   generated again, and are added to a chunk's maps whenever it is filled.
+//   The chunk cache and region files only ever hold generated maps.
+
+/// Height added to each full resolution cube of the chunk at position.
+struct ChunkEdits
+{
+  vec2 position;
+  float height_deltas[CHUNK_SIZE*CHUNK_SIZE];
+};
+
+/// Open-addressing hashmap of ChunkEdits keyed by chunk position, with linear
+///   probing. Slots hold pointers to the edits, 0 where empty, and edits are
+///   only removed all together.
+struct TerrainEdits
+{
+  ChunkEdits **slots;
+  int capacity;
+  int n_chunks;
+};
+
+
+/// capacity must be a power of two.
+void
+terrain_edits_init(TerrainEdits *edits, int capacity);
+
+void
+terrain_edits_free(TerrainEdits *edits);
+
+/// Forget every edit.
+void
+terrain_edits_clear(TerrainEdits *edits);
+
+/// Return the edits of the chunk at position, or 0 if it has none.
+ChunkEdits *
+terrain_edits_find(TerrainEdits *edits, vec2 position);
+
+/// Return the edits of the chunk at position, adding them with every delta 0
+///   if it has none.
+ChunkEdits *
+terrain_edits_get(TerrainEdits *edits, vec2 position);
+
+/// Fill maps of every level of detail with what the edits add to the chunk at
+///   position: its deltas for heights and their gradient for slopes, the
+///   coarser levels averaged from them as build_chunk_lods() averages generated
+///   maps. Returns false, leaving the maps unset, if neither the chunk nor its
+///   neighbours, which its border slopes reach, have edits.
+bool
+get_chunk_edit_maps(TerrainEdits *edits, vec2 position, float *height_map, vec2 *slope_map);
+
+
+#endif
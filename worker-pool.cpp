@@ -0,0 +1,142 @@
+#include "worker-pool.h"
+
+
+/// Claim and run items from batch until none are left.
+void
+work_on_batch(WorkBatch *batch)
+{
+  int item_n = batch->next_item.fetch_add(1);
+  while (item_n < batch->n_items)
+  {
+    batch->function(batch->data, item_n);
+    item_n = batch->next_item.fetch_add(1);
+  }
+}
+
+
+void
+worker_thread(WorkerPool *pool)
+{
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  while (true)
+  {
+    pool->work_available.wait(lock, [pool] { return pool->shutting_down || !pool->batches.empty() || !pool->jobs.empty(); });
+    if (pool->shutting_down)
+    {
+      break;
+    }
+
+    if (pool->batches.empty())
+    {
+      WorkJob job = pool->jobs.front();
+      pool->jobs.pop_front();
+
+      lock.unlock();
+      job.function(job.data, job.item_n);
+      lock.lock();
+      continue;
+    }
+
+    WorkBatch *batch = pool->batches.front();
+    if (batch->next_item.load() >= batch->n_items)
+    {
+      // Every item has been claimed, the rest are finishing on other threads
+      pool->batches.pop_front();
+      continue;
+    }
+
+    batch->n_active_workers.fetch_add(1);
+    lock.unlock();
+
+    work_on_batch(batch);
+    batch->n_active_workers.fetch_sub(1, std::memory_order_release);
+
+    lock.lock();
+  }
+}
+
+
+void
+worker_pool_init(WorkerPool *pool, int n_threads)
+{
+  pool->shutting_down = false;
+  for (int thread_n = 0;
+       thread_n < n_threads;
+       ++thread_n)
+  {
+    pool->threads.emplace_back(worker_thread, pool);
+  }
+}
+
+
+void
+worker_pool_shutdown(WorkerPool *pool, std::vector<WorkJob> *unrun_jobs)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->shutting_down = true;
+  }
+  pool->work_available.notify_all();
+
+  for (std::thread &thread : pool->threads)
+  {
+    thread.join();
+  }
+  pool->threads.clear();
+
+  if (unrun_jobs)
+  {
+    unrun_jobs->insert(unrun_jobs->end(), pool->jobs.begin(), pool->jobs.end());
+  }
+  pool->jobs.clear();
+}
+
+
+void
+parallel_for(WorkerPool *pool, int n_items, WorkFunction function, void *data)
+{
+  WorkBatch batch;
+  batch.function = function;
+  batch.data = data;
+  batch.n_items = n_items;
+  batch.next_item = 0;
+  batch.n_active_workers = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->batches.push_back(&batch);
+  }
+  pool->work_available.notify_all();
+
+  work_on_batch(&batch);
+
+  // Every item is claimed, remove the batch so no more workers can join it
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    for (auto it = pool->batches.begin(); it != pool->batches.end(); ++it)
+    {
+      if (*it == &batch)
+      {
+        pool->batches.erase(it);
+        break;
+      }
+    }
+  }
+
+  // Then wait for the workers still finishing their items
+  while (batch.n_active_workers.load(std::memory_order_acquire) > 0)
+  {
+    std::this_thread::yield();
+  }
+}
+
+
+void
+worker_pool_push_job(WorkerPool *pool, WorkFunction function, void *data, int item_n)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->jobs.push_back({function, data, item_n});
+  }
+  pool->work_available.notify_one();
+}
@@ -0,0 +1,68 @@
+#ifndef WORKER_POOL_H_DEF
+#define WORKER_POOL_H_DEF
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+typedef void (*WorkFunction)(void *data, int item_n);
+
+/// A batch of n_items independent calls to function(data, item_n), claimed one
+///   item at a time by whichever thread gets to it first.
+struct WorkBatch
+{
+  WorkFunction function;
+  void *data;
+  int n_items;
+
+  std::atomic<int> next_item;
+
+  // Workers still inside the batch, it must outlive them
+  std::atomic<int> n_active_workers;
+};
+
+/// A single call to function(data, item_n) that nobody waits on.
+struct WorkJob
+{
+  WorkFunction function;
+  void *data;
+  int item_n;
+};
+
+struct WorkerPool
+{
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::deque<WorkBatch *> batches;
+  std::deque<WorkJob> jobs;
+  bool shutting_down;
+};
+
+
+void
+worker_pool_init(WorkerPool *pool, int n_threads);
+
+/// Finish the jobs being run and stop every thread. Jobs still queued are not
+///   run, and are moved into unrun_jobs unless it is 0, for their data to be
+///   freed.
+void
+worker_pool_shutdown(WorkerPool *pool, std::vector<WorkJob> *unrun_jobs = 0);
+
+/// Run function(data, item_n) for every item_n in [0, n_items) across the pool,
+///   with the calling thread helping, and return once every item is done.
+void
+parallel_for(WorkerPool *pool, int n_items, WorkFunction function, void *data);
+
+/// Queue function(data, item_n) to run on a worker thread and return immediately.
+///   parallel_for() batches are always picked up before queued jobs.
+void
+worker_pool_push_job(WorkerPool *pool, WorkFunction function, void *data, int item_n);
+
+
+#endif